@@ -0,0 +1,138 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "avl_database.hpp"
+#include "bplus_tree_database.hpp"
+#include "memory_avl_database.hpp"
+#include "static_avl_index.hpp"
+
+using namespace std;
+
+/**
+ * Runs the same insert / get / remove workload on a database engine and
+ * prints the time spent on each phase
+ *
+ * @tparam Database The engine (AvlDatabase, BPlusTreeDatabase, ...)
+ */
+template <typename Database>
+void run_benchmark(const string &name, const vector<int> &keys) {
+  string data_path = name + "_bench_data.bin";
+  string tree_path = name + "_bench_tree.bin";
+  remove(data_path.c_str());
+  remove(tree_path.c_str());
+
+  double add_time, get_time, remove_time;
+  int height;
+  {
+    Database tree(data_path, tree_path);
+    chrono::steady_clock::time_point start;
+
+    start = chrono::steady_clock::now();
+    for (auto key : keys) {
+      tree.add(key, key);
+    }
+    add_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    height = tree.get_height();
+
+    start = chrono::steady_clock::now();
+    for (auto key : keys) {
+      if (tree.get(key) != key) {
+        cerr << name << ": wrong value for key " << key << endl;
+        exit(1);
+      }
+    }
+    get_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (auto key : keys) {
+      tree.remove(key);
+    }
+    remove_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+
+  double n = keys.size();
+  cout << name << endl;
+  cout << "  height (reads per lookup): " << height << endl;
+  cout << "  add:    " << add_time << " s (" << add_time / n * 1e6 << " us/op)" << endl;
+  cout << "  get:    " << get_time << " s (" << get_time / n * 1e6 << " us/op)" << endl;
+  cout << "  remove: " << remove_time << " s (" << remove_time / n * 1e6 << " us/op)" << endl;
+
+  remove(data_path.c_str());
+  remove(tree_path.c_str());
+}
+
+/**
+ * Exports an AvlDatabase with the keys to a static index and prints the time
+ * spent on lookups on both
+ */
+void run_static_benchmark(const vector<int> &keys) {
+  string data_path = "static_bench_data.bin";
+  string tree_path = "static_bench_tree.bin";
+  string index_path = "static_bench_index.bin";
+  remove(data_path.c_str());
+  remove(tree_path.c_str());
+
+  double tree_time, index_time;
+  {
+    AvlDatabase<int, int> tree(data_path, tree_path);
+    for (auto key : keys) {
+      tree.add(key, key);
+    }
+    tree.export_static(index_path);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (auto key : keys) {
+      tree.get(key);
+    }
+    tree_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+
+  {
+    StaticAvlIndex<int, int> index(index_path);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (auto key : keys) {
+      if (index.get(key) != key) {
+        cerr << "static: wrong value for key " << key << endl;
+        exit(1);
+      }
+    }
+    index_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+
+  double n = keys.size();
+  cout << "static (lookups only)" << endl;
+  cout << "  avl get:    " << tree_time << " s (" << tree_time / n * 1e6 << " us/op)" << endl;
+  cout << "  static get: " << index_time << " s (" << index_time / n * 1e6 << " us/op)" << endl;
+
+  remove(data_path.c_str());
+  remove(tree_path.c_str());
+  remove(index_path.c_str());
+}
+
+/**
+ * Usage: engine_benchmark [number of keys]
+ */
+int main(int argc, char **argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 2000;
+
+  // Deterministic shuffled keys
+  vector<int> keys;
+  for (int i = 0; i < n; i++) {
+    keys.push_back(i);
+  }
+  srand(42);
+  for (int i = n - 1; i > 0; i--) {
+    swap(keys[i], keys[rand() % (i + 1)]);
+  }
+
+  cout << "Keys: " << n << endl;
+  run_benchmark<AvlDatabase<int, int> >("avl", keys);
+  run_benchmark<BPlusTreeDatabase<int, int> >("bplus", keys);
+  run_benchmark<MemoryAvlDatabase<int, int> >("memory", keys);
+  run_static_benchmark(keys);
+}
@@ -0,0 +1,458 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <stdexcept>
+
+#include "avl_database.hpp"
+#include "bplus_tree_database.hpp"
+#include "memory_avl_database.hpp"
+
+using namespace std;
+
+/**
+ * Non-interactive load driver
+ *
+ * Either replays an operation file (one "READ|INSERT|UPDATE|DELETE key" per
+ * line, which also accepts YCSB traces like "READ usertable user123 ...") or
+ * generates a read/insert/update/remove mix with uniform or zipfian keys, and
+ * reports throughput and p50/p99/p999 latency per operation.
+ *
+ * Trace keys are mapped to ints in the order they first appear. Before a
+ * trace runs, the keys of the load file (like the output of "ycsb load") are
+ * inserted; without one, the keys the trace uses before inserting them are.
+ *
+ * Usage: load_driver [--option=value ...]
+ *   --engine=avl|bplus|memory    database engine (default avl)
+ *   --trace=path                 replay operations from file
+ *   --load=path                  keys of this file are loaded before the trace
+ *   --records=n                  keys loaded before the generated run (default 1000)
+ *   --operations=n               generated operations (default 10000)
+ *   --read=r --insert=r --update=r --remove=r
+ *                                operation ratios (default 0.8/0.1/0/0.1)
+ *   --distribution=uniform|zipfian  key distribution (default zipfian)
+ *   --theta=t                    zipfian skew (default 0.99)
+ *   --threads=n                  client threads (default 1)
+ *   --seed=n                     random seed (default 42)
+ *   --data=path --tree=path      database files (removed before the run)
+ */
+
+enum Operation { READ, INSERT, UPDATE, REMOVE, OPERATION_COUNT };
+
+const char *operation_names[OPERATION_COUNT] = { "read", "insert", "update", "remove" };
+
+struct Request {
+  Operation operation;
+  int key;
+};
+
+/**
+ * Latencies (in nanoseconds) and misses of one kind of operation
+ */
+struct OperationStats {
+  vector<long long> latencies;
+  long long misses;
+
+  OperationStats() : misses(0) { }
+};
+
+/**
+ * Zipfian generator over [0, n), as described by Gray et al. in "Quickly
+ * Generating Billion-Record Synthetic Databases" (the one used by YCSB)
+ *
+ * Ranks are scrambled with a hash so hot keys are spread over the tree
+ */
+class ZipfianGenerator {
+  public:
+    ZipfianGenerator(int n, double theta) : n(n), theta(theta) {
+      zeta_n = zeta(n);
+      alpha = 1.0 / (1.0 - theta);
+      eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2) / zeta_n);
+    }
+
+    template <typename Random>
+    int next(Random &random) {
+      double u = uniform_real_distribution<double>(0.0, 1.0)(random);
+      double uz = u * zeta_n;
+      long long rank;
+      if (uz < 1.0) {
+        rank = 0;
+      } else if (uz < 1.0 + pow(0.5, theta)) {
+        rank = 1;
+      } else {
+        rank = (long long)(n * pow(eta * u - eta + 1.0, alpha));
+      }
+      rank = min(rank, (long long)n - 1);
+
+      // FNV-1a scramble
+      unsigned long long hash = 14695981039346656037ULL;
+      for (int i = 0; i < 8; i++) {
+        hash ^= (rank >> (i * 8)) & 0xff;
+        hash *= 1099511628211ULL;
+      }
+      return hash % n;
+    }
+
+  private:
+    int n;
+    double theta;
+    double zeta_n;
+    double alpha;
+    double eta;
+
+    double zeta(int count) {
+      double sum = 0;
+      for (int i = 1; i <= count; i++) {
+        sum += 1.0 / pow(i, theta);
+      }
+      return sum;
+    }
+};
+
+/**
+ * Parses "--name=value" arguments
+ */
+map<string, string> parse_options(int argc, char **argv) {
+  map<string, string> options;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    size_t equal = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || equal == string::npos) {
+      throw invalid_argument("Invalid argument: " + arg);
+    }
+    options[arg.substr(2, equal - 2)] = arg.substr(equal + 1);
+  }
+  return options;
+}
+
+string get_option(const map<string, string> &options, const string &name, const string &default_value) {
+  map<string, string>::const_iterator it = options.find(name);
+  return it == options.end() ? default_value : it->second;
+}
+
+/**
+ * Maps trace keys to ints (in the order they first appear)
+ */
+typedef unordered_map<string, int> KeyDictionary;
+
+/**
+ * Reads an operation file
+ *
+ * Unknown operations (like SCAN) and lines without a numeric key are skipped
+ */
+vector<Request> read_trace(const string &path, KeyDictionary &dictionary) {
+  ifstream file(path);
+  if (!file) {
+    throw invalid_argument("Could not open trace file " + path);
+  }
+
+  vector<Request> requests;
+  string line;
+  while (getline(file, line)) {
+    istringstream tokens(line);
+    string name;
+    tokens >> name;
+    transform(name.begin(), name.end(), name.begin(), ::toupper);
+
+    Request request;
+    if (name == "READ" || name == "GET") {
+      request.operation = READ;
+    } else if (name == "INSERT" || name == "ADD") {
+      request.operation = INSERT;
+    } else if (name == "UPDATE") {
+      request.operation = UPDATE;
+    } else if (name == "DELETE" || name == "REMOVE") {
+      request.operation = REMOVE;
+    } else {
+      continue;
+    }
+
+    // First token that is a number (ignoring a "user" prefix) is the key
+    string token;
+    bool found = false;
+    while (!found && tokens >> token) {
+      if (token.compare(0, 4, "user") == 0) {
+        token = token.substr(4);
+      }
+      if (!token.empty() && (isdigit(token[0]) || token[0] == '-')) {
+        request.key = dictionary.insert(make_pair(token, (int)dictionary.size())).first->second;
+        found = true;
+      }
+    }
+
+    if (found) {
+      requests.push_back(request);
+    }
+  }
+
+  return requests;
+}
+
+/**
+ * Generates the operation mix
+ *
+ * Reads and updates hit the preloaded keys [0, records). Removes take the
+ * keys loaded after them, one each, so they always hit and never delete a
+ * key that is read later. Inserts always use new keys
+ */
+vector<Request> generate_requests(const map<string, string> &options, int records) {
+  int operations = atoi(get_option(options, "operations", "10000").c_str());
+  double read = atof(get_option(options, "read", "0.8").c_str());
+  double insert = atof(get_option(options, "insert", "0.1").c_str());
+  double update = atof(get_option(options, "update", "0").c_str());
+  double remove = atof(get_option(options, "remove", "0.1").c_str());
+  string distribution = get_option(options, "distribution", "zipfian");
+  double theta = atof(get_option(options, "theta", "0.99").c_str());
+  unsigned seed = atoi(get_option(options, "seed", "42").c_str());
+
+  if (read + insert + update + remove <= 0) {
+    throw invalid_argument("Operation ratios must not all be zero");
+  }
+  if (records <= 0 && (read > 0 || update > 0)) {
+    throw invalid_argument("Reads and updates need --records > 0");
+  }
+  if (distribution != "uniform" && distribution != "zipfian") {
+    throw invalid_argument("Unknown distribution " + distribution);
+  }
+
+  mt19937_64 random(seed);
+  uniform_real_distribution<double> choice(0.0, read + insert + update + remove);
+  uniform_int_distribution<int> uniform(0, max(records - 1, 0));
+  ZipfianGenerator zipfian(max(records, 2), theta);
+
+  vector<Request> requests;
+  int removes = 0;
+  for (int i = 0; i < operations; i++) {
+    double c = choice(random);
+    Request request;
+    if (c < insert) {
+      request.operation = INSERT;
+    } else if (c < insert + read) {
+      request.operation = READ;
+    } else if (c < insert + read + update) {
+      request.operation = UPDATE;
+    } else {
+      request.operation = REMOVE;
+      removes++;
+    }
+
+    if (request.operation == READ || request.operation == UPDATE) {
+      request.key = distribution == "uniform" ? uniform(random) : zipfian.next(random) % records;
+    }
+    requests.push_back(request);
+  }
+
+  int next_remove_key = records;
+  int next_insert_key = records + removes;
+  for (auto &request : requests) {
+    if (request.operation == INSERT) {
+      request.key = next_insert_key++;
+    } else if (request.operation == REMOVE) {
+      request.key = next_remove_key++;
+    }
+  }
+
+  return requests;
+}
+
+/**
+ * Whether an engine can be called from several client threads at once
+ * (MemoryAvlDatabase locks internally)
+ */
+template <typename Database>
+struct is_thread_safe : false_type { };
+
+template <typename K, typename T>
+struct is_thread_safe<MemoryAvlDatabase<K, T> > : true_type { };
+
+/**
+ * Replaces the info of key, as remove + add on engines without update()
+ * @throws invalid_argument If information with that key doesn't exist
+ */
+template <typename Database>
+void update_info(Database &tree, int key, int info) {
+  tree.remove(key);
+  tree.add(key, info);
+}
+
+template <typename K, typename T>
+void update_info(AvlDatabase<K, T> &tree, int key, int info) {
+  tree.update(key, info);
+}
+
+template <typename K, typename T>
+void update_info(MemoryAvlDatabase<K, T> &tree, int key, int info) {
+  tree.update(key, info);
+}
+
+long long percentile(const vector<long long> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = (size_t)ceil(p * sorted.size());
+  return sorted[min(max(index, (size_t)1), sorted.size()) - 1];
+}
+
+/**
+ * Gets the keys loaded before a trace runs: every key of the load file or,
+ * without one, the keys the trace uses before inserting them
+ */
+vector<int> get_trace_load_keys(const vector<Request> &load_requests, const vector<Request> &requests,
+                                size_t key_count) {
+  vector<char> seen(key_count, 0);
+  vector<int> keys;
+  for (auto &request : load_requests.empty() ? requests : load_requests) {
+    if (!seen[request.key]) {
+      seen[request.key] = 1;
+      if (!load_requests.empty() || request.operation != INSERT) {
+        keys.push_back(request.key);
+      }
+    }
+  }
+  return keys;
+}
+
+/**
+ * Loads the database, runs the requests on the client threads and prints
+ * the report
+ *
+ * Operations on engines that aren't thread safe are serialized by a mutex
+ * and measured latencies include the time waiting for it
+ *
+ * @tparam Database The engine (AvlDatabase, BPlusTreeDatabase, ...)
+ */
+template <typename Database>
+void run(const map<string, string> &options, const string &engine) {
+  string data_path = get_option(options, "data", "driver_data.bin");
+  string tree_path = get_option(options, "tree", "driver_tree.bin");
+  int records = atoi(get_option(options, "records", "1000").c_str());
+  int threads = max(1, atoi(get_option(options, "threads", "1").c_str()));
+  string trace = get_option(options, "trace", "");
+
+  vector<Request> requests;
+  vector<int> load_keys;
+  if (trace.empty()) {
+    requests = generate_requests(options, records);
+
+    // Generated removes delete the keys loaded after the first records
+    int loaded = records + count_if(requests.begin(), requests.end(),
+                                    [](const Request &request) { return request.operation == REMOVE; });
+    for (int key = 0; key < loaded; key++) {
+      load_keys.push_back(key);
+    }
+  } else {
+    KeyDictionary dictionary;
+    string load = get_option(options, "load", "");
+    vector<Request> load_requests = load.empty() ? vector<Request>() : read_trace(load, dictionary);
+    requests = read_trace(trace, dictionary);
+    load_keys = get_trace_load_keys(load_requests, requests, dictionary.size());
+    records = load_keys.size();
+  }
+
+  remove(data_path.c_str());
+  remove(tree_path.c_str());
+  Database tree(data_path, tree_path);
+  mutex tree_mutex;
+
+  for (auto key : load_keys) {
+    tree.add(key, key);
+  }
+
+  vector<vector<OperationStats> > stats(threads, vector<OperationStats>(OPERATION_COUNT));
+  atomic<size_t> next_request(0);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  vector<thread> clients;
+  for (int t = 0; t < threads; t++) {
+    clients.push_back(thread([&, t]() {
+      size_t i;
+      while ((i = next_request++) < requests.size()) {
+        const Request &request = requests[i];
+        OperationStats &operation_stats = stats[t][request.operation];
+
+        chrono::steady_clock::time_point operation_start = chrono::steady_clock::now();
+        try {
+          unique_lock<mutex> lock(tree_mutex, defer_lock);
+          if (!is_thread_safe<Database>::value) {
+            lock.lock();
+          }
+          if (request.operation == READ) {
+            tree.get(request.key);
+          } else if (request.operation == INSERT) {
+            tree.add(request.key, request.key);
+          } else if (request.operation == UPDATE) {
+            update_info(tree, request.key, -request.key);
+          } else {
+            tree.remove(request.key);
+          }
+        } catch (invalid_argument &) {
+          operation_stats.misses++;
+        }
+        chrono::steady_clock::time_point operation_end = chrono::steady_clock::now();
+
+        operation_stats.latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(operation_end - operation_start).count());
+      }
+    }));
+  }
+  for (auto &client : clients) {
+    client.join();
+  }
+
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  cout << "engine: " << engine << ", threads: " << threads << ", records: " << records
+       << ", operations: " << requests.size() << endl;
+  cout << "elapsed: " << elapsed << " s, throughput: " << requests.size() / elapsed << " ops/s" << endl;
+  cout << "operation    count   misses   p50(us)   p99(us)  p999(us)   max(us)" << endl;
+
+  for (int op = 0; op < OPERATION_COUNT; op++) {
+    vector<long long> latencies;
+    long long misses = 0;
+    for (int t = 0; t < threads; t++) {
+      latencies.insert(latencies.end(), stats[t][op].latencies.begin(), stats[t][op].latencies.end());
+      misses += stats[t][op].misses;
+    }
+    sort(latencies.begin(), latencies.end());
+
+    char line[128];
+    snprintf(line, sizeof(line), "%-9s %8zu %8lld %9.1f %9.1f %9.1f %9.1f",
+             operation_names[op], latencies.size(), misses,
+             percentile(latencies, 0.50) / 1000.0, percentile(latencies, 0.99) / 1000.0,
+             percentile(latencies, 0.999) / 1000.0, latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+    cout << line << endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  try {
+    map<string, string> options = parse_options(argc, argv);
+    string engine = get_option(options, "engine", "avl");
+
+    if (engine == "avl") {
+      run<AvlDatabase<int, int> >(options, engine);
+    } else if (engine == "bplus") {
+      run<BPlusTreeDatabase<int, int> >(options, engine);
+    } else if (engine == "memory") {
+      run<MemoryAvlDatabase<int, int> >(options, engine);
+    } else {
+      throw invalid_argument("Unknown engine " + engine);
+    }
+  } catch (invalid_argument &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+}
@@ -2,11 +2,23 @@
 #define AVLDATABASE_H
 
 #include <stdexcept>
+#include <cstring>
 #include <ios>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <atomic>
+#include <thread>
 
 #include "binary_storage.hpp"
+#include "static_avl_index.hpp"
+#include "secondary_index.hpp"
 
 /**
  * Struct for Node stored in a binary file
@@ -14,17 +26,65 @@
  * valid -> if the node is valid
  * key -> the key which will be used to compare this node with others
  * data_index -> the index of the data stored in this node
- * balance -> left tree height - right tree height
+ * balance -> right tree height - left tree height
  * left -> left child index
  * right -> right child index
+ *
+ * @tparam K The type of the key
  */
-typedef struct Node {
-  int key;
+template <typename K>
+struct Node {
+  K key;
   int data_index;
   int balance;
   int left;
   int right;
-} Node;
+};
+
+/**
+ * Result of AvlDatabase::verify()
+ *
+ * nodes -> number of nodes reachable from the root
+ * free_nodes -> number of invalid node blocks (reused by next insertions)
+ * leaked_nodes -> valid node blocks that aren't reachable from the root
+ * leaked_data -> valid data blocks that aren't used by any reachable node
+ * error_count -> number of broken invariants, only the first MAX_ERRORS
+ *                messages are kept on errors
+ */
+struct VerifyReport {
+  static const int MAX_ERRORS = 100;
+
+  int nodes;
+  int free_nodes;
+  int leaked_nodes;
+  int leaked_data;
+  int error_count;
+  std::vector<std::string> errors;
+
+  VerifyReport()
+    : nodes(0), free_nodes(0), leaked_nodes(0), leaked_data(0), error_count(0) { }
+
+  bool is_valid() const {
+    return error_count == 0 && leaked_nodes == 0 && leaked_data == 0;
+  }
+
+  void add_error(const std::string &error) {
+    if (error_count++ < MAX_ERRORS) {
+      errors.push_back(error);
+    }
+  }
+
+  void merge(const VerifyReport &other) {
+    nodes += other.nodes;
+    free_nodes += other.free_nodes;
+    leaked_nodes += other.leaked_nodes;
+    leaked_data += other.leaked_data;
+    for (auto &error : other.errors) {
+      add_error(error);
+    }
+    error_count += other.error_count - (int)other.errors.size();
+  }
+};
 
 /**
  * Implementation of a database using AvlTree concepts and binary files
@@ -70,6 +130,22 @@ class AvlDatabase {
       } else {
         add_recursive(key, info, read_root_pos());
       }
+
+      // If an index throws, the info is removed from the indexes that
+      // already have it and from the tree
+      size_t added = 0;
+      try {
+        for (; added < indexes.size(); added++) {
+          indexes[added]->add(key, info);
+        }
+      } catch (...) {
+        while (added > 0) {
+          added--;
+          indexes[added]->remove(key, info);
+        }
+        write_root_pos(remove_recursive(key, read_root_pos()));
+        throw;
+      }
     }
 
     /** 
@@ -82,11 +158,85 @@ class AvlDatabase {
       if (tree_is_empty()) {
         throw std::invalid_argument("No info matches key passed to remove()");
       }
+
+      // Secondary indexes need the old info to find their nodes
+      T info;
+      if (!indexes.empty()) {
+        info = get(key);
+      }
       
+      // Indexes are changed first, and restored if one of them throws, so
+      // the info is only removed from the tree when every index succeeded
+      size_t removed = 0;
+      try {
+        for (; removed < indexes.size(); removed++) {
+          indexes[removed]->remove(key, info);
+        }
+      } catch (...) {
+        while (removed > 0) {
+          removed--;
+          indexes[removed]->add(key, info);
+        }
+        throw;
+      }
+
       int new_root_pos = remove_recursive(key, read_root_pos());
       write_root_pos(new_root_pos);
     }
 
+    /** 
+     * Replaces info on tree
+     * @param key Key of the information
+     * @param info The new information
+     * @throws invalid_argument If information with that key doesn't exist
+     */
+    void update(const K &key, const T &info) {
+      Node<K> node = node_storage.read(get_node_pos_recursive(key, read_root_pos())).data;
+      T old_info = data_storage.read(node.data_index).data;
+
+      // Indexes are changed first, and restored if one of them throws, so
+      // they never point to an info that wasn't written
+      size_t updated = 0;
+      try {
+        for (; updated < indexes.size(); updated++) {
+          indexes[updated]->remove(key, old_info);
+          try {
+            indexes[updated]->add(key, info);
+          } catch (...) {
+            indexes[updated]->add(key, old_info);
+            throw;
+          }
+        }
+      } catch (...) {
+        while (updated > 0) {
+          updated--;
+          indexes[updated]->remove(key, info);
+          indexes[updated]->add(key, old_info);
+        }
+        throw;
+      }
+
+      data_storage.write(FlaggedBlock<T>(1, info), node.data_index);
+    }
+
+    /**
+     * Removes every info from the tree (and from its secondary indexes),
+     * replacing both files with empty ones
+     * @throws runtime_error If the new files can't be written
+     */
+    void clear() {
+      int root_pos = -1;
+      std::vector<char> data_buffer, node_buffer;
+      serialize_blocks(std::vector<FlaggedBlock<T> >(), NULL, 0, data_buffer);
+      serialize_blocks(std::vector<FlaggedBlock<Node<K> > >(), &root_pos, 1, node_buffer);
+      replace_file(data_storage, data_buffer);
+      replace_file(node_storage, node_buffer);
+
+      for (auto &index : indexes) {
+        index->clear();
+      }
+    }
+
     /** 
      * Gets info from tree
      * @param key Key of the information
@@ -96,6 +246,73 @@ class AvlDatabase {
       return get_info_recursive(key, read_root_pos());
     }
 
+    /**
+     * Gets all infos with keys between from and to (inclusive), ordered by key
+     * @param from The smallest key of the range
+     * @param to The biggest key of the range
+     */
+    std::vector<T> get_range(const K &from, const K &to) {
+      std::vector<T> infos;
+      if (!tree_is_empty()) {
+        get_range_recursive(from, to, read_root_pos(), infos);
+      }
+      return infos;
+    }
+
+    /**
+     * Registers a secondary index over a field of the infos
+     *
+     * The index is kept up to date by add(), remove() and update(). If its
+     * files are empty, it is filled with the infos already on the tree,
+     * otherwise they are expected to match the tree.
+     *
+     * @tparam S The type of the secondary key (not unique). It's stored as
+     * raw bytes on the index files, so it must be trivially copyable: index
+     * a string field as a std::array<char, N>, not as a std::string
+     * @param data_path path to the index data binary file
+     * @param tree_path path to the index tree binary file
+     * @param extractor function that returns the secondary key of an info
+     * @return The index, to be passed to get_by() and get_range_by()
+     */
+    template <typename S>
+    SecondaryIndex<K, T, S> &add_index(std::string data_path, std::string tree_path,
+                                       std::function<S(const T&)> extractor) {
+      SecondaryIndex<K, T, S> *index = new SecondaryIndex<K, T, S>(data_path, tree_path, extractor);
+      indexes.push_back(std::unique_ptr<SecondaryIndexBase<K, T> >(index));
+
+      if (index->is_empty() && !tree_is_empty()) {
+        fill_index_recursive(*index, read_root_pos());
+      }
+
+      return *index;
+    }
+
+    /**
+     * Gets all infos with a secondary key, ordered by primary key
+     * @param index Index returned by add_index()
+     * @param key The secondary key
+     */
+    template <typename S>
+    std::vector<T> get_by(SecondaryIndex<K, T, S> &index, const S &key) {
+      return get_range_by(index, key, key);
+    }
+
+    /**
+     * Gets all infos with secondary keys between from and to (inclusive),
+     * ordered by secondary key and then by primary key
+     * @param index Index returned by add_index()
+     * @param from The smallest secondary key of the range
+     * @param to The biggest secondary key of the range
+     */
+    template <typename S>
+    std::vector<T> get_range_by(SecondaryIndex<K, T, S> &index, const S &from, const S &to) {
+      std::vector<T> infos;
+      for (auto &primary : index.get_primary_keys(from, to)) {
+        infos.push_back(get(primary));
+      }
+      return infos;
+    }
+
     /** 
      * Gets the tree height 
      */
@@ -123,9 +340,243 @@ class AvlDatabase {
       os << "-----------------------------" << std::endl;
     }
 
+    /**
+     * Exports the tree to a read only file that can be opened with
+     * StaticAvlIndex
+     * @param path path to the static index file
+     * @throws runtime_error If the file can't be written
+     */
+    void export_static(std::string path) {
+      std::vector<K> keys;
+      std::vector<T> infos;
+      if (!tree_is_empty()) {
+        export_recursive(read_root_pos(), keys, infos);
+      }
+      StaticAvlIndex<K, T>::write(path, keys, infos);
+    }
+
+    /**
+     * Checks the tree files: key ordering, balance fields, AVL heights and
+     * reachability of node and data blocks
+     *
+     * The top of the tree is checked first, then its subtrees are checked by
+     * a pool of threads, each one reading the files with positional reads.
+     * Must not run while the tree is being changed.
+     *
+     * @param threads number of threads (0 uses one per core)
+     */
+    VerifyReport verify(int threads = 0) {
+      threads = get_thread_count(threads);
+
+      std::vector<std::unique_ptr<BlockReader<Node<K> > > > node_readers;
+      std::vector<std::unique_ptr<BlockReader<T> > > data_readers;
+      for (int t = 0; t < threads; t++) {
+        node_readers.push_back(std::unique_ptr<BlockReader<Node<K> > >(new BlockReader<Node<K> >(node_storage.get_path(), 1)));
+        data_readers.push_back(std::unique_ptr<BlockReader<T> >(new BlockReader<T>(data_storage.get_path(), 0)));
+      }
+
+      VerifyReport report;
+      std::vector<std::atomic<char> > visited(node_readers[0]->get_data_count());
+      std::vector<std::atomic<char> > data_used(data_readers[0]->get_data_count());
+      VerifyContext context = { visited, data_used };
+
+      // Check the top levels until there are enough subtrees for the threads
+      std::vector<VerifyTask> level;
+      std::vector<VerifyTop> top;
+      std::vector<int> heights;
+
+      int root_pos = node_readers[0]->read_flag(0);
+      if (root_pos != -1) {
+        level.push_back(VerifyTask { root_pos, KeyBounds(), 0 });
+        heights.push_back(0);
+      }
+
+      for (int depth = 0; !level.empty() && (int)level.size() < threads * 4 && depth < 32; depth++) {
+        std::vector<VerifyTask> next_level;
+        for (auto &task : level) {
+          VerifyTop entry = { task.pos, Node<K>(), task.slot, -1, -1 };
+          if (!verify_node(*node_readers[0], *data_readers[0], context, task.pos, task.bounds, entry.node, report)) {
+            continue;
+          }
+
+          if (entry.node.left != -1) {
+            entry.left_slot = heights.size();
+            heights.push_back(0);
+            next_level.push_back(VerifyTask { entry.node.left, task.bounds.below(entry.node.key), entry.left_slot });
+          }
+          if (entry.node.right != -1) {
+            entry.right_slot = heights.size();
+            heights.push_back(0);
+            next_level.push_back(VerifyTask { entry.node.right, task.bounds.above(entry.node.key), entry.right_slot });
+          }
+          top.push_back(entry);
+        }
+        level.swap(next_level);
+      }
+
+      // Check the remaining subtrees in parallel
+      std::vector<VerifyReport> task_reports(level.size());
+      std::atomic<size_t> next_task(0);
+      run_threads(threads, [&](int t) {
+        size_t i;
+        while ((i = next_task++) < level.size()) {
+          heights[level[i].slot] = verify_subtree(*node_readers[t], *data_readers[t], context, level[i], task_reports[i]);
+        }
+      });
+      for (auto &task_report : task_reports) {
+        report.merge(task_report);
+      }
+
+      // Top nodes were stored parents first, so childs get their heights first
+      for (int i = top.size() - 1; i >= 0; i--) {
+        int left_height = top[i].left_slot == -1 ? 0 : heights[top[i].left_slot];
+        int right_height = top[i].right_slot == -1 ? 0 : heights[top[i].right_slot];
+        verify_heights(top[i].pos, top[i].node, left_height, right_height, report);
+        heights[top[i].slot] = std::max(left_height, right_height) + 1;
+      }
+
+      // Look for leaked blocks, each thread reading a contiguous range in
+      // batches
+      std::vector<VerifyReport> scan_reports(threads);
+      run_threads(threads, [&](int t) {
+        std::vector<FlaggedBlock<Node<K> > > nodes;
+        int node_chunk = (visited.size() + threads - 1) / threads;
+        int node_end = std::min((int)visited.size(), (t + 1) * node_chunk);
+        for (int first = t * node_chunk; first < node_end; first += SCAN_BATCH) {
+          int count = std::min(SCAN_BATCH, node_end - first);
+          node_readers[t]->read_range(first, count, nodes);
+          for (int i = 0; i < count; i++) {
+            if (!nodes[i].is_valid()) {
+              scan_reports[t].free_nodes++;
+            } else if (!visited[first + i]) {
+              scan_reports[t].leaked_nodes++;
+            }
+          }
+        }
+
+        std::vector<FlaggedBlock<T> > infos;
+        int data_chunk = (data_used.size() + threads - 1) / threads;
+        int data_end = std::min((int)data_used.size(), (t + 1) * data_chunk);
+        for (int first = t * data_chunk; first < data_end; first += SCAN_BATCH) {
+          int count = std::min(SCAN_BATCH, data_end - first);
+          data_readers[t]->read_range(first, count, infos);
+          for (int i = 0; i < count; i++) {
+            if (!data_used[first + i] && infos[i].is_valid()) {
+              scan_reports[t].leaked_data++;
+            }
+          }
+        }
+      });
+      for (auto &scan_report : scan_reports) {
+        report.merge(scan_report);
+      }
+
+      return report;
+    }
+
+    /**
+     * Rebuilds the tree file from the valid node blocks, ignoring the links
+     * between them
+     *
+     * Node blocks are read in parallel with positional reads. Nodes whose
+     * data block isn't valid are dropped and, for repeated keys, the first
+     * block wins. The nodes are written in key order as a perfectly balanced
+     * tree to a new file that replaces the tree file, and data blocks that
+     * aren't used by it are freed. Secondary indexes are cleared and filled
+     * again from the rebuilt tree.
+     *
+     * @param threads number of threads (0 uses one per core)
+     * @return Number of nodes on the rebuilt tree
+     * @throws runtime_error If the new tree or index files can't be written
+     */
+    int rebuild(int threads = 0) {
+      threads = get_thread_count(threads);
+
+      std::vector<std::pair<K, int> > entries;
+      std::vector<char> data_used;
+      {
+        BlockReader<Node<K> > count_reader(node_storage.get_path(), 1);
+        BlockReader<T> data_count_reader(data_storage.get_path(), 0);
+        int node_count = count_reader.get_data_count();
+        int data_count = data_count_reader.get_data_count();
+        int chunk = (node_count + threads - 1) / threads;
+
+        // Each thread reads a contiguous range, so entries keep block order
+        std::vector<std::vector<std::pair<K, int> > > thread_entries(threads);
+        run_threads(threads, [&](int t) {
+          BlockReader<Node<K> > node_reader(node_storage.get_path(), 1);
+          BlockReader<T> data_reader(data_storage.get_path(), 0);
+          std::vector<FlaggedBlock<Node<K> > > blocks;
+          int end = std::min(node_count, (t + 1) * chunk);
+          for (int first = t * chunk; first < end; first += SCAN_BATCH) {
+            int count = std::min(SCAN_BATCH, end - first);
+            node_reader.read_range(first, count, blocks);
+            for (auto &block : blocks) {
+              int data_index = block.data.data_index;
+              if (block.is_valid() && data_index >= 0 && data_index < data_count &&
+                  data_reader.read(data_index).is_valid()) {
+                thread_entries[t].push_back(std::make_pair(block.data.key, data_index));
+              }
+            }
+          }
+        });
+
+        size_t entry_count = 0;
+        for (auto &part : thread_entries) {
+          entry_count += part.size();
+        }
+        entries.reserve(entry_count);
+        for (auto &part : thread_entries) {
+          entries.insert(entries.end(), part.begin(), part.end());
+          std::vector<std::pair<K, int> >().swap(part);
+        }
+
+        std::stable_sort(entries.begin(), entries.end(), compare_entries);
+        entries.erase(std::unique(entries.begin(), entries.end(), same_entry_key), entries.end());
+
+        // A data block used by two nodes is kept only by the first one
+        data_used.assign(data_count, 0);
+        size_t kept = 0;
+        for (auto &entry : entries) {
+          if (!data_used[entry.second]) {
+            data_used[entry.second] = 1;
+            entries[kept++] = entry;
+          }
+        }
+        entries.resize(kept);
+      }
+
+      // Node of entries[i] is serialized straight into block i of the file
+      std::vector<char> buffer(sizeof(int) + entries.size() * (sizeof(int) + sizeof(Node<K>)));
+      int height;
+      int root_pos = build_balanced(entries, buffer.data() + sizeof(int), 0, entries.size(), height);
+      std::memcpy(buffer.data(), &root_pos, sizeof(int));
+      replace_file(node_storage, buffer);
+      std::vector<char>().swap(buffer);
+
+      // Free data blocks that aren't used anymore
+      for (size_t i = 0; i < data_used.size(); i++) {
+        if (!data_used[i] && data_storage.read(i).is_valid()) {
+          data_storage.remove(i);
+        }
+      }
+
+      // Index entries of dropped nodes would point to missing infos
+      for (auto &index : indexes) {
+        index->clear();
+        fill_index_recursive(*index, root_pos);
+      }
+
+      return entries.size();
+    }
+
   private:
+    // Blocks read at once by the sequential scans of verify() and rebuild()
+    static const int SCAN_BATCH = 4096;
+
     BinaryStorage<T> data_storage;
-    BinaryStorage<Node> node_storage;
+    BinaryStorage<Node<K> > node_storage;
+    std::vector<std::unique_ptr<SecondaryIndexBase<K, T> > > indexes;
 
     /**
      * Adds data recursively on the tree
@@ -135,8 +586,8 @@ class AvlDatabase {
      */
     void add_recursive(const K &key, const T &info, int current_pos) {
       // Get current node
-      FlaggedBlock<Node> block = node_storage.read(current_pos);
-      Node node = block.data;
+      FlaggedBlock<Node<K> > block = node_storage.read(current_pos);
+      Node<K> node = block.data;
 
       // Check current node key to find where
       // to insert
@@ -176,24 +627,31 @@ class AvlDatabase {
      *
      * If it has childs, it will return the index to the biggest node from the
      * left or the smallest node from the right
+     *
+     * remove_data is false when the node's data was moved to another node
+     * and must stay on data_storage
      */
-    int remove_recursive(const K &key, int current_pos) {
+    int remove_recursive(const K &key, int current_pos, bool remove_data = true) {
       if (current_pos == -1) {
         throw std::invalid_argument("Info not on tree");
       }
 
-      FlaggedBlock<Node> block = node_storage.read(current_pos);
-      Node node = block.data;
+      FlaggedBlock<Node<K> > block = node_storage.read(current_pos);
+      Node<K> node = block.data;
 
       // If this node must be removed
       if (node.key == key) {
+        if (remove_data && (node.left != -1 || node.right != -1)) {
+          data_storage.remove(node.data_index);
+        }
+
         if (node.left != -1) {
-          FlaggedBlock<Node> biggest_block = node_storage.read(get_biggest_node_pos(node.left));
-          Node biggest_node = biggest_block.data;
+          FlaggedBlock<Node<K> > biggest_block = node_storage.read(get_biggest_node_pos(node.left));
+          Node<K> biggest_node = biggest_block.data;
 
-          remove_recursive(biggest_node.key, node.left);
+          remove_recursive(biggest_node.key, node.left, false);
 
-          FlaggedBlock<Node> left_block = node_storage.read(node.left);
+          FlaggedBlock<Node<K> > left_block = node_storage.read(node.left);
           if (!left_block.is_valid()) {
             node.left = -1;
           }
@@ -201,12 +659,12 @@ class AvlDatabase {
           node.key = biggest_node.key;
           node.data_index = biggest_node.data_index;
         } else if (node.right != -1) {
-          FlaggedBlock<Node> smallest_block = node_storage.read(get_smallest_node_pos(node.right));
-          Node smallest_node = smallest_block.data;
+          FlaggedBlock<Node<K> > smallest_block = node_storage.read(get_smallest_node_pos(node.right));
+          Node<K> smallest_node = smallest_block.data;
           
-          remove_recursive(smallest_node.key, node.right);
+          remove_recursive(smallest_node.key, node.right, false);
 
-          FlaggedBlock<Node> right_block = node_storage.read(node.right);
+          FlaggedBlock<Node<K> > right_block = node_storage.read(node.right);
           if (!right_block.is_valid()) {
             node.right = -1;
           }
@@ -215,13 +673,15 @@ class AvlDatabase {
           node.data_index = smallest_node.data_index;
         } else {
           node_storage.remove(current_pos);
-          data_storage.remove(node.data_index);
+          if (remove_data) {
+            data_storage.remove(node.data_index);
+          }
           return -1;
         }
       } else if (key > node.key) {
-        node.right = remove_recursive(key, node.right);
+        node.right = remove_recursive(key, node.right, remove_data);
       } else if (key < node.key) {
-        node.left = remove_recursive(key, node.left);
+        node.left = remove_recursive(key, node.left, remove_data);
       }
       
       update_node(current_pos, node);
@@ -235,8 +695,8 @@ class AvlDatabase {
     /**
      * Gets smallest node index starting from node at position passed by parameter
      */ 
-    K get_smallest_node_pos(int current_pos) {
-      Node node = node_storage.read(current_pos).data;
+    int get_smallest_node_pos(int current_pos) {
+      Node<K> node = node_storage.read(current_pos).data;
       if (node.left != -1) {
         return get_smallest_node_pos(node.left);
       } else {
@@ -247,8 +707,8 @@ class AvlDatabase {
     /**
      * Gets biggest key starting from node at position passed by parameter
      */ 
-    K get_biggest_node_pos(int current_pos) {
-      Node node = node_storage.read(current_pos).data;
+    int get_biggest_node_pos(int current_pos) {
+      Node<K> node = node_storage.read(current_pos).data;
       if (node.right != -1) {
         return get_biggest_node_pos(node.right);
       } else {
@@ -264,8 +724,8 @@ class AvlDatabase {
         throw std::invalid_argument("No info matches key passed to get_info()");
       }
 
-      FlaggedBlock<Node> block = node_storage.read(current_pos);
-      Node node = block.data;
+      FlaggedBlock<Node<K> > block = node_storage.read(current_pos);
+      Node<K> node = block.data;
 
       if (key == node.key) {
         return data_storage.read(node.data_index).data;
@@ -276,6 +736,61 @@ class AvlDatabase {
       }
     }
 
+    /**
+     * Gets node position recursively from the tree
+     */
+    int get_node_pos_recursive(const K &key, int current_pos) {
+      if (current_pos == -1) {
+        throw std::invalid_argument("No info matches key passed to update()");
+      }
+
+      Node<K> node = node_storage.read(current_pos).data;
+
+      if (key == node.key) {
+        return current_pos;
+      } else if (key > node.key) {
+        return get_node_pos_recursive(key, node.right);
+      } else {
+        return get_node_pos_recursive(key, node.left);
+      }
+    }
+
+    /**
+     * Collects infos with keys between from and to recursively, in ascending
+     * key order
+     */
+    void get_range_recursive(const K &from, const K &to, int pos, std::vector<T> &infos) {
+      if (pos == -1) {
+        return;
+      }
+
+      Node<K> node = node_storage.read(pos).data;
+
+      if (from < node.key) {
+        get_range_recursive(from, to, node.left, infos);
+      }
+      if (!(node.key < from) && !(to < node.key)) {
+        infos.push_back(data_storage.read(node.data_index).data);
+      }
+      if (node.key < to) {
+        get_range_recursive(from, to, node.right, infos);
+      }
+    }
+
+    /**
+     * Adds every info of the tree to a secondary index recursively
+     */
+    void fill_index_recursive(SecondaryIndexBase<K, T> &index, int pos) {
+      if (pos == -1) {
+        return;
+      }
+
+      Node<K> node = node_storage.read(pos).data;
+      fill_index_recursive(index, node.left);
+      index.add(node.key, data_storage.read(node.data_index).data);
+      fill_index_recursive(index, node.right);
+    }
+
     /** 
      * Gets height of node at specified position
      */
@@ -284,8 +799,8 @@ class AvlDatabase {
         return 0;
       }
 
-      FlaggedBlock<Node> block = node_storage.read(pos);
-      Node node = block.data;
+      FlaggedBlock<Node<K> > block = node_storage.read(pos);
+      Node<K> node = block.data;
 
       if (!block.is_valid()) {
          return 0;
@@ -302,7 +817,7 @@ class AvlDatabase {
         return 0;
       }
 
-      Node node = node_storage.read(pos).data;
+      Node<K> node = node_storage.read(pos).data;
 
       return (get_node_height(node.right) - get_node_height(node.left));
     }
@@ -311,7 +826,7 @@ class AvlDatabase {
      * Balance node at specified position
      */
     void balance_node(int pos) {
-      Node node = node_storage.read(pos).data;
+      Node<K> node = node_storage.read(pos).data;
       if (node.balance > 1) {
         if (node_storage.read(node.right).data.balance < 0) {
           rotate_double_left(pos);
@@ -331,9 +846,9 @@ class AvlDatabase {
      * Applies left rotation to node at given position
      */
     void rotate_left(int pos) {
-      Node old_root = node_storage.read(pos).data;
+      Node<K> old_root = node_storage.read(pos).data;
       node_storage.swap(pos, old_root.right);
-      Node new_root = node_storage.read(pos).data;
+      Node<K> new_root = node_storage.read(pos).data;
 
       int old_root_pos = old_root.right;
       int new_root_left_pos = new_root.left;
@@ -353,9 +868,9 @@ class AvlDatabase {
      * Applies right rotation to node at given position
      */
     void rotate_right(int pos) {
-      Node old_root = node_storage.read(pos).data;
+      Node<K> old_root = node_storage.read(pos).data;
       node_storage.swap(pos, old_root.left);
-      Node new_root = node_storage.read(pos).data;
+      Node<K> new_root = node_storage.read(pos).data;
 
       int old_root_pos = old_root.left;
       int new_root_right_pos = new_root.right;
@@ -375,7 +890,7 @@ class AvlDatabase {
      * Applies double left rotation to node at given position
      */
     void rotate_double_left(int pos) {
-      Node node = node_storage.read(pos).data;
+      Node<K> node = node_storage.read(pos).data;
       rotate_right(node.right);
       rotate_left(pos);
     }
@@ -384,7 +899,7 @@ class AvlDatabase {
      * Applies double right rotation to node at given position
      */
     void rotate_double_right(int pos) {
-      Node node = node_storage.read(pos).data;
+      Node<K> node = node_storage.read(pos).data;
       rotate_left(node.left);
       rotate_right(pos);
     }
@@ -395,8 +910,8 @@ class AvlDatabase {
      */
     int write_data_node(const K& key, const T& info) {
       int data_index = data_storage.write(FlaggedBlock<T>(1, info));
-      Node new_node = { key, data_index, 0, -1, -1 };
-      int node_index = node_storage.write(FlaggedBlock<Node>(1, new_node));
+      Node<K> new_node = { key, data_index, 0, -1, -1 };
+      int node_index = node_storage.write(FlaggedBlock<Node<K> >(1, new_node));
       return node_index;
     }
     
@@ -420,8 +935,260 @@ class AvlDatabase {
      *
      * This is an auxilar function, since this code is used a lot in this class
      */ 
-    void update_node(int pos, Node node) {
-      node_storage.write(FlaggedBlock<Node>(1, node), pos);
+    void update_node(int pos, Node<K> node) {
+      node_storage.write(FlaggedBlock<Node<K> >(1, node), pos);
+    }
+
+    /**
+     * Collects keys and infos recursively, in ascending key order
+     */
+    void export_recursive(int pos, std::vector<K> &keys, std::vector<T> &infos) {
+      if (pos == -1) {
+        return;
+      }
+
+      Node<K> node = node_storage.read(pos).data;
+      export_recursive(node.left, keys, infos);
+      keys.push_back(node.key);
+      infos.push_back(data_storage.read(node.data_index).data);
+      export_recursive(node.right, keys, infos);
+    }
+
+    /**
+     * Bounds that the keys of a subtree must be strictly between
+     */
+    struct KeyBounds {
+      bool has_low;
+      K low;
+      bool has_high;
+      K high;
+
+      KeyBounds() : has_low(false), low(), has_high(false), high() { }
+
+      KeyBounds below(const K &key) const {
+        KeyBounds bounds = *this;
+        bounds.has_high = true;
+        bounds.high = key;
+        return bounds;
+      }
+
+      KeyBounds above(const K &key) const {
+        KeyBounds bounds = *this;
+        bounds.has_low = true;
+        bounds.low = key;
+        return bounds;
+      }
+
+      bool contains(const K &key) const {
+        return (!has_low || low < key) && (!has_high || key < high);
+      }
+    };
+
+    /**
+     * Subtree to be checked by verify(), slot is where its height is stored
+     */
+    struct VerifyTask {
+      int pos;
+      KeyBounds bounds;
+      int slot;
+    };
+
+    /**
+     * Node checked by verify() before splitting the tree between threads
+     */
+    struct VerifyTop {
+      int pos;
+      Node<K> node;
+      int slot;
+      int left_slot;
+      int right_slot;
+    };
+
+    /**
+     * Marks shared by the verify() threads
+     */
+    struct VerifyContext {
+      std::vector<std::atomic<char> > &visited;
+      std::vector<std::atomic<char> > &data_used;
+    };
+
+    static int get_thread_count(int threads) {
+      if (threads <= 0) {
+        threads = std::thread::hardware_concurrency();
+      }
+      return std::max(threads, 1);
+    }
+
+    /**
+     * Runs function(thread_index) on threads threads and waits for them
+     */
+    template <typename Function>
+    static void run_threads(int threads, Function function) {
+      std::vector<std::thread> workers;
+      for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread(function, t));
+      }
+      for (auto &worker : workers) {
+        worker.join();
+      }
+    }
+
+    /**
+     * Checks a node reached from its parent (or the root position) and marks
+     * it and its data block as used
+     *
+     * Returns false if the node can't be read or was already reached, so its
+     * childs must not be checked
+     */
+    bool verify_node(BlockReader<Node<K> > &node_reader, BlockReader<T> &data_reader, VerifyContext &context,
+                     int pos, const KeyBounds &bounds, Node<K> &node, VerifyReport &report) {
+      std::ostringstream error;
+
+      if (pos < 0 || pos >= (int)context.visited.size()) {
+        error << "Node position " << pos << " is out of the tree file";
+        report.add_error(error.str());
+        return false;
+      }
+
+      if (context.visited[pos].exchange(1)) {
+        error << "Node " << pos << " is reachable more than once";
+        report.add_error(error.str());
+        return false;
+      }
+
+      FlaggedBlock<Node<K> > block = node_reader.read(pos);
+      if (!block.is_valid()) {
+        error << "Node " << pos << " is reachable but invalid";
+        report.add_error(error.str());
+        return false;
+      }
+
+      node = block.data;
+      report.nodes++;
+
+      if (!bounds.contains(node.key)) {
+        error << "Node " << pos << " key " << node.key << " is out of order";
+        report.add_error(error.str());
+      }
+
+      if (node.data_index < 0 || node.data_index >= (int)context.data_used.size()) {
+        error << "Node " << pos << " data index " << node.data_index << " is out of the data file";
+        report.add_error(error.str());
+      } else if (!data_reader.read(node.data_index).is_valid()) {
+        error << "Node " << pos << " data block " << node.data_index << " is invalid";
+        report.add_error(error.str());
+      } else if (context.data_used[node.data_index].exchange(1)) {
+        error << "Node " << pos << " data block " << node.data_index << " is used by another node";
+        report.add_error(error.str());
+      }
+
+      return true;
+    }
+
+    /**
+     * Checks balance field and AVL height difference of a node
+     */
+    void verify_heights(int pos, const Node<K> &node, int left_height, int right_height, VerifyReport &report) {
+      std::ostringstream error;
+      int balance = right_height - left_height;
+
+      if (balance < -1 || balance > 1) {
+        error << "Node " << pos << " is unbalanced (" << balance << ")";
+        report.add_error(error.str());
+      } else if (node.balance != balance) {
+        error << "Node " << pos << " balance is " << node.balance << " instead of " << balance;
+        report.add_error(error.str());
+      }
+    }
+
+    /**
+     * Checks a subtree without recursion (a broken tree may be as deep as
+     * its number of nodes) and returns its height
+     */
+    int verify_subtree(BlockReader<Node<K> > &node_reader, BlockReader<T> &data_reader, VerifyContext &context,
+                       const VerifyTask &task, VerifyReport &report) {
+      struct Frame {
+        int pos;
+        Node<K> node;
+        KeyBounds bounds;
+        int stage;
+        int left_height;
+      };
+
+      std::vector<Frame> stack;
+      // Height of the last subtree finished
+      int height = 0;
+
+      auto enter = [&](int pos, const KeyBounds &bounds) {
+        height = 0;
+        Frame frame = { pos, Node<K>(), bounds, 0, 0 };
+        if (pos != -1 && verify_node(node_reader, data_reader, context, pos, bounds, frame.node, report)) {
+          stack.push_back(frame);
+        }
+      };
+
+      enter(task.pos, task.bounds);
+      while (!stack.empty()) {
+        Frame &frame = stack.back();
+        if (frame.stage == 0) {
+          frame.stage = 1;
+          enter(frame.node.left, frame.bounds.below(frame.node.key));
+        } else if (frame.stage == 1) {
+          frame.stage = 2;
+          frame.left_height = height;
+          enter(frame.node.right, frame.bounds.above(frame.node.key));
+        } else {
+          verify_heights(frame.pos, frame.node, frame.left_height, height, report);
+          height = std::max(frame.left_height, height) + 1;
+          stack.pop_back();
+        }
+      }
+
+      return height;
+    }
+
+    static bool compare_entries(const std::pair<K, int> &a, const std::pair<K, int> &b) {
+      return a.first < b.first;
+    }
+
+    static bool same_entry_key(const std::pair<K, int> &a, const std::pair<K, int> &b) {
+      return !(a.first < b.first) && !(b.first < a.first);
+    }
+
+    /**
+     * Builds a perfectly balanced tree from sorted entries, serializing the
+     * node of entries[i] as block i of blocks
+     *
+     * Returns the position of the subtree root
+     */
+    int build_balanced(const std::vector<std::pair<K, int> > &entries, char *blocks,
+                       int begin, int end, int &height) {
+      if (begin >= end) {
+        height = 0;
+        return -1;
+      }
+
+      int middle = begin + (end - begin) / 2;
+      int left_height, right_height;
+      int left = build_balanced(entries, blocks, begin, middle, left_height);
+      int right = build_balanced(entries, blocks, middle + 1, end, right_height);
+
+      Node<K> node = { entries[middle].first, entries[middle].second, right_height - left_height, left, right };
+      serialize_block(FlaggedBlock<Node<K> >(1, node), blocks + (size_t)middle * (sizeof(int) + sizeof(Node<K>)));
+      height = std::max(left_height, right_height) + 1;
+      return middle;
+    }
+
+    /**
+     * Writes a serialized file (with the BinaryStorage layout) to a new file
+     * in one sequential write, syncs it and replaces the file of storage
+     * with it
+     */
+    template <typename B>
+    static void replace_file(BinaryStorage<B> &storage, const std::vector<char> &buffer) {
+      std::string path = storage.get_path() + ".rebuild";
+      write_file_synced(path, buffer);
+      storage.replace(path);
     }
 
     /**
@@ -432,8 +1199,8 @@ class AvlDatabase {
         return;
       }
 
-      FlaggedBlock<Node> block = node_storage.read(pos);
-      Node node = block.data;
+      FlaggedBlock<Node<K> > block = node_storage.read(pos);
+      Node<K> node = block.data;
 
       if (!block.is_valid()) {
         os << "INVALID NODE (this shouldn't happen)" << std::endl;
@@ -455,4 +1222,7 @@ class AvlDatabase {
     }
 };
 
+template <typename K, typename T>
+const int AvlDatabase<K, T>::SCAN_BATCH;
+
 #endif
\ No newline at end of file
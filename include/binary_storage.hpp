@@ -2,9 +2,18 @@
 #define BINARYSTORAGE_H
 
 #include <stdexcept>
+#include <cstdio>
+#include <cstring>
 #include <ios>
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
 
 /**
  * Simple encapsulator
@@ -28,6 +37,117 @@ class FlaggedBlock {
 };
 
 
+/**
+ * Serializes a block with the layout used by BinaryStorage (valid, then data)
+ */
+template <typename T>
+void serialize_block(const FlaggedBlock<T> &block, char *buffer) {
+  std::memcpy(buffer, &block.valid, sizeof(int));
+  std::memcpy(buffer + sizeof(int), &block.data, sizeof(T));
+}
+
+/**
+ * Serializes flags and blocks with the file layout used by BinaryStorage
+ */
+template <typename T>
+void serialize_blocks(const std::vector<FlaggedBlock<T> > &blocks, const int *flags, int number_of_flags,
+                      std::vector<char> &buffer) {
+  size_t header_size = number_of_flags * sizeof(int);
+  size_t block_size = sizeof(int) + sizeof(T);
+  buffer.resize(header_size + blocks.size() * block_size);
+
+  if (number_of_flags > 0) {
+    std::memcpy(buffer.data(), flags, header_size);
+  }
+  for (size_t i = 0; i < blocks.size(); i++) {
+    serialize_block(blocks[i], buffer.data() + header_size + i * block_size);
+  }
+}
+
+/**
+ * Writes buffer to a new file and flushes it to disk (fsync)
+ * @throws runtime_error If the file can't be written
+ */
+inline void write_file_synced(const std::string &path, const std::vector<char> &buffer) {
+#ifdef _WIN32
+  std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  file.write(buffer.data(), buffer.size());
+  file.flush();
+  if (!file) {
+    throw std::runtime_error("Could not write " + path);
+  }
+#else
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw std::runtime_error("Could not write " + path);
+  }
+
+  size_t done = 0;
+  while (done < buffer.size()) {
+    ssize_t count = write(fd, buffer.data() + done, buffer.size() - done);
+    if (count <= 0) {
+      close(fd);
+      throw std::runtime_error("Could not write " + path);
+    }
+    done += count;
+  }
+
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  if (!synced) {
+    throw std::runtime_error("Could not sync " + path);
+  }
+#endif
+}
+
+/**
+ * Flushes the directory of path to disk (fsync), so files created or
+ * renamed in it survive a crash
+ * @throws runtime_error If the directory can't be synced
+ */
+inline void sync_directory(const std::string &path) {
+#ifndef _WIN32
+  size_t slash = path.find_last_of('/');
+  std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+
+  int fd = open(directory.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error("Could not open directory " + directory);
+  }
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  if (!synced) {
+    throw std::runtime_error("Could not sync directory " + directory);
+  }
+#endif
+}
+
+/**
+ * Renames source_path over path
+ * @throws runtime_error If the file can't be renamed
+ */
+inline void rename_file(const std::string &source_path, const std::string &path) {
+#ifdef _WIN32
+  std::remove(path.c_str());
+#endif
+  if (std::rename(source_path.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Could not replace " + path + " with " + source_path);
+  }
+}
+
+/**
+ * Replaces the file at path with buffer: writes and syncs path + ".tmp",
+ * renames it over path and syncs the directory, so after a crash path has
+ * either the old or the new content
+ * @throws runtime_error If the file can't be written
+ */
+inline void write_file_atomically(const std::string &path, const std::vector<char> &buffer) {
+  std::string temporary_path = path + ".tmp";
+  write_file_synced(temporary_path, buffer);
+  rename_file(temporary_path, path);
+  sync_directory(path);
+}
+
 /**
  * Implementation of a class that stores an array of a certain type on a binary
  * file and has implementations of basic CRUD (create, remove, update and
@@ -44,6 +164,7 @@ template <typename T>
 class BinaryStorage {
   public:
     BinaryStorage(std::string path, int number_of_flags) {
+      this->path = path;
       this->number_of_flags = number_of_flags;
 
       // Create files if it doesn't exist
@@ -136,9 +257,35 @@ class BinaryStorage {
     bool is_empty() {
       return (get_file_size() == 0);
     }
+
+    std::string get_path() {
+      return path;
+    }
+
+    /**
+     * Replaces the file with another one with the same layout (renaming it
+     * over the current file), syncs the directory and reopens the stream
+     * @throws runtime_error If the file can't be renamed or reopened
+     */
+    void replace(std::string source_path) {
+      file.close();
+      try {
+        rename_file(source_path, path);
+        sync_directory(path);
+      } catch (...) {
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::ate);
+        throw;
+      }
+
+      file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::ate);
+      if (!file.is_open()) {
+        throw std::runtime_error("Could not reopen " + path);
+      }
+    }
     
   private:
     std::fstream file;
+    std::string path;
     int number_of_flags;
 
     int get_file_size() {
@@ -184,4 +331,126 @@ class BinaryStorage {
 
 };
 
-#endif
\ No newline at end of file
+/**
+ * Read only access to a file written by BinaryStorage using positional reads
+ * (pread), so several readers can read the same file from different threads
+ * without sharing a stream position
+ *
+ * @tparam T The type of the info stored
+ */
+template <typename T>
+class BlockReader {
+  public:
+    /**
+     * @throws runtime_error If the file can't be opened
+     */
+    BlockReader(std::string path, int number_of_flags) {
+      this->number_of_flags = number_of_flags;
+#ifdef _WIN32
+      file.open(path, std::ios::in | std::ios::binary);
+      if (!file) {
+        throw std::runtime_error("Could not open " + path);
+      }
+      file.seekg(0, std::ios::end);
+      file_size = file.tellg();
+#else
+      fd = open(path.c_str(), O_RDONLY);
+      if (fd == -1) {
+        throw std::runtime_error("Could not open " + path);
+      }
+      file_size = lseek(fd, 0, SEEK_END);
+#endif
+    }
+
+    ~BlockReader() {
+#ifndef _WIN32
+      close(fd);
+#endif
+    }
+
+    int read_flag(int index) {
+      int flag = -1;
+      read_at(index * sizeof(int), reinterpret_cast<char*>(&flag), sizeof(int));
+      return flag;
+    }
+
+    /**
+     * Reads block at index (blocks that can't be read are returned invalid)
+     */
+    FlaggedBlock<T> read(int index) {
+      char buffer[sizeof(int) + sizeof(T)];
+      FlaggedBlock<T> block;
+      block.valid = 0;
+
+      long long pos = number_of_flags * sizeof(int) + (long long)index * sizeof(buffer);
+      if (read_at(pos, buffer, sizeof(buffer)) == sizeof(buffer)) {
+        std::memcpy(&block.valid, buffer, sizeof(int));
+        std::memcpy(&block.data, buffer + sizeof(int), sizeof(T));
+      }
+      return block;
+    }
+
+    /**
+     * Reads count blocks starting at first with a single read (blocks that
+     * can't be read are returned invalid)
+     */
+    void read_range(int first, int count, std::vector<FlaggedBlock<T> > &blocks) {
+      size_t block_size = sizeof(int) + sizeof(T);
+      buffer.resize(count * block_size);
+      blocks.resize(count);
+
+      long long pos = number_of_flags * sizeof(int) + (long long)first * block_size;
+      size_t read_blocks = read_at(pos, buffer.data(), buffer.size()) / block_size;
+      for (int i = 0; i < count; i++) {
+        blocks[i].valid = 0;
+        if ((size_t)i < read_blocks) {
+          std::memcpy(&blocks[i].valid, buffer.data() + i * block_size, sizeof(int));
+          std::memcpy(&blocks[i].data, buffer.data() + i * block_size + sizeof(int), sizeof(T));
+        }
+      }
+    }
+
+    int get_data_count() {
+      long long size = file_size - number_of_flags * (long long)sizeof(int);
+      return size < 0 ? 0 : size / (sizeof(int) + sizeof(T));
+    }
+
+  private:
+#ifdef _WIN32
+    std::ifstream file;
+#else
+    int fd;
+#endif
+    long long file_size;
+    int number_of_flags;
+    std::vector<char> buffer;
+
+    // The file descriptor is closed by the destructor, so readers can't be
+    // copied
+    BlockReader(const BlockReader&);
+    BlockReader& operator=(const BlockReader&);
+
+    /**
+     * Reads up to size bytes at pos, returns the number of bytes read
+     */
+    size_t read_at(long long pos, char *buffer, size_t size) {
+#ifdef _WIN32
+      file.clear();
+      file.seekg(pos, std::ios::beg);
+      file.read(buffer, size);
+      return file.gcount();
+#else
+      size_t done = 0;
+      while (done < size) {
+        ssize_t count = pread(fd, buffer + done, size - done, pos + done);
+        if (count <= 0) {
+          break;
+        }
+        done += count;
+      }
+      return done;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,530 @@
+#ifndef BPLUSTREEDATABASE_H
+#define BPLUSTREEDATABASE_H
+
+#include <stdexcept>
+#include <algorithm>
+#include <ios>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include "binary_storage.hpp"
+
+/**
+ * Struct for Page stored in a binary file
+ *
+ * leaf -> 1 if the page is a leaf, 0 if it is an internal page
+ * count -> number of keys stored in the page
+ * next -> index of the next leaf page (only used by leaves, -1 on the last)
+ * keys -> sorted keys of the page
+ * children -> on internal pages, children[i] holds keys smaller than keys[i]
+ *             and children[i + 1] holds keys bigger or equal to keys[i]
+ *             on leaf pages, children[i] is the data index of keys[i]
+ *
+ * @tparam K The type of the key stored in the page
+ * @tparam Order The maximum number of keys in a page
+ */
+template <typename K, int Order>
+struct Page {
+  int leaf;
+  int count;
+  int next;
+  K keys[Order];
+  int children[Order + 1];
+};
+
+/**
+ * Implementation of a database using B+Tree concepts and binary files
+ *
+ * Has the same interface as AvlDatabase, but each node is a page with up to
+ * Order keys, so a lookup reads about log(n) / log(Order) pages instead of
+ * the ~1.44 * log2(n) nodes read by the AVL tree. Leaves are linked, which
+ * allows ordered range scans.
+ *
+ * @tparam K The type of the key used to compare infos
+ * @tparam T The type of the info stored
+ * @tparam Order The maximum number of keys in a page
+ */
+template <typename K, typename T, int Order = 128>
+class BPlusTreeDatabase {
+  static_assert(Order >= 3, "B+Tree order must be at least 3");
+
+  public:
+    typedef Page<K, Order> PageType;
+
+    /**
+     * BPlusTreeDatabase constructor
+     * @param data_path path to the data binary file
+     * @param tree_path path to the tree binary file
+     */
+    BPlusTreeDatabase(std::string data_path, std::string tree_path)
+      : data_storage(data_path, 0), page_storage(tree_path, 1) {
+      if (tree_is_empty()) {
+        write_root_pos(-1);
+      }
+    }
+
+    /**
+     * Add new information to the tree
+     * @param key Key of the information (must be unique)
+     * @param info The information that will be inserted
+     * @throws invalid_argument If another information has the same key
+     */
+    void add(const K &key, const T &info) {
+      // If tree is empty, first insertion
+      if (tree_is_empty()) {
+        PageType page = empty_page(1);
+        page.keys[0] = key;
+        page.children[0] = data_storage.write(FlaggedBlock<T>(1, info));
+        page.count = 1;
+        write_root_pos(page_storage.write(FlaggedBlock<PageType>(1, page)));
+        return;
+      }
+
+      K split_key;
+      int split_pos = add_recursive(key, info, read_root_pos(), split_key);
+
+      // Root was split, tree grows one level
+      if (split_pos != -1) {
+        PageType root = empty_page(0);
+        root.count = 1;
+        root.keys[0] = split_key;
+        root.children[0] = read_root_pos();
+        root.children[1] = split_pos;
+        write_root_pos(page_storage.write(FlaggedBlock<PageType>(1, root)));
+      }
+    }
+
+    /**
+     * Removes info from tree
+     * @param key Key of the information
+     * @throws invalid_argument If information with that key doesn't exist
+     */
+    void remove(const K &key) {
+      // Throw exception if tree is empty
+      if (tree_is_empty()) {
+        throw std::invalid_argument("No info matches key passed to remove()");
+      }
+
+      int root_pos = read_root_pos();
+      remove_recursive(key, root_pos);
+
+      // Shrink the tree if the root became empty
+      PageType root = read_page(root_pos);
+      if (root.count == 0) {
+        page_storage.remove(root_pos);
+        write_root_pos(root.leaf ? -1 : root.children[0]);
+      }
+    }
+
+    /**
+     * Gets info from tree
+     * @param key Key of the information
+     * @throws invalid_argument If information with that key doesn't exist
+     */
+    T get(const K &key) {
+      if (tree_is_empty()) {
+        throw std::invalid_argument("No info matches key passed to get_info()");
+      }
+
+      PageType page = find_leaf(key);
+      int i = lower_index(page, key);
+      if (i == page.count || page.keys[i] != key) {
+        throw std::invalid_argument("No info matches key passed to get_info()");
+      }
+
+      return data_storage.read(page.children[i]).data;
+    }
+
+    /**
+     * Gets all infos with keys between from and to (inclusive), ordered by key
+     * @param from The smallest key of the range
+     * @param to The biggest key of the range
+     */
+    std::vector<T> get_range(const K &from, const K &to) {
+      std::vector<T> infos;
+      if (tree_is_empty()) {
+        return infos;
+      }
+
+      PageType page = find_leaf(from);
+      int i = lower_index(page, from);
+      while (true) {
+        for (; i < page.count; i++) {
+          if (to < page.keys[i]) {
+            return infos;
+          }
+          infos.push_back(data_storage.read(page.children[i]).data);
+        }
+
+        if (page.next == -1) {
+          return infos;
+        }
+        page = read_page(page.next);
+        i = 0;
+      }
+    }
+
+    /**
+     * Gets the tree height (number of page levels)
+     */
+    int get_height() {
+      if (tree_is_empty()) {
+        return 0;
+      }
+
+      int height = 1;
+      PageType page = read_page(read_root_pos());
+      while (!page.leaf) {
+        page = read_page(page.children[0]);
+        height++;
+      }
+      return height;
+    }
+
+    /**
+     * Checks if the tree is empty
+     * @return true If the tree is empty
+     * @return false If the tree is not empty
+     */
+    bool tree_is_empty() {
+      return page_storage.is_empty() || read_root_pos() == -1;
+    }
+
+    /**
+     * Prints the tree
+     * @param os The output stream to print the tree
+     */
+    void print(std::ostream &os) {
+      os << "-----------------------------" << std::endl;
+      os << "Tree height: " << get_height() << std::endl;
+      if (!tree_is_empty()) {
+        print_recursive(os, read_root_pos(), 0);
+      }
+      os << "-----------------------------" << std::endl;
+    }
+
+  private:
+    BinaryStorage<T> data_storage;
+    BinaryStorage<PageType> page_storage;
+
+    /**
+     * Adds data recursively on the tree
+     *
+     * Returns the position of the new right sibling if the page at
+     * current_pos was split (and sets split_key to the first key reachable
+     * through it), or -1 if it wasn't
+     */
+    int add_recursive(const K &key, const T &info, int current_pos, K &split_key) {
+      PageType page = read_page(current_pos);
+
+      if (page.leaf) {
+        int i = lower_index(page, key);
+        if (i < page.count && page.keys[i] == key) {
+          throw std::invalid_argument("Info already on tree");
+        }
+
+        int data_index = data_storage.write(FlaggedBlock<T>(1, info));
+        return insert_and_split(page, current_pos, i, key, data_index, split_key);
+      }
+
+      int i = child_index(page, key);
+      K child_split_key;
+      int child_split_pos = add_recursive(key, info, page.children[i], child_split_key);
+      if (child_split_pos == -1) {
+        return -1;
+      }
+
+      return insert_and_split(page, current_pos, i, child_split_key, child_split_pos, split_key);
+    }
+
+    /**
+     * Inserts key at index i of the page (with its data index on leaves, or
+     * its right child on internal pages) and splits the page if it overflows
+     *
+     * Returns the position of the new right page or -1 if there was no split
+     */
+    int insert_and_split(PageType &page, int pos, int i, const K &key, int child, K &split_key) {
+      // Internal pages store the child to the right of the key
+      int child_offset = page.leaf ? 0 : 1;
+
+      // Keys and children of an overflowing page
+      K keys[Order + 1];
+      int children[Order + 2];
+      std::copy(page.keys, page.keys + i, keys);
+      std::copy(page.keys + i, page.keys + page.count, keys + i + 1);
+      keys[i] = key;
+      int children_count = page.count + child_offset;
+      std::copy(page.children, page.children + i + child_offset, children);
+      std::copy(page.children + i + child_offset, page.children + children_count, children + i + child_offset + 1);
+      children[i + child_offset] = child;
+
+      int count = page.count + 1;
+      if (count <= Order) {
+        std::copy(keys, keys + count, page.keys);
+        std::copy(children, children + count + child_offset, page.children);
+        page.count = count;
+        update_page(pos, page);
+        return -1;
+      }
+
+      PageType right = empty_page(page.leaf);
+      int left_count = count / 2;
+
+      if (page.leaf) {
+        // Leaves keep every key, the right page first key is copied up
+        right.count = count - left_count;
+        std::copy(keys + left_count, keys + count, right.keys);
+        std::copy(children + left_count, children + count, right.children);
+        split_key = right.keys[0];
+      } else {
+        // Internal pages move the middle key up
+        right.count = count - left_count - 1;
+        std::copy(keys + left_count + 1, keys + count, right.keys);
+        std::copy(children + left_count + 1, children + count + 1, right.children);
+        split_key = keys[left_count];
+      }
+
+      page.count = left_count;
+      std::copy(keys, keys + left_count, page.keys);
+      std::copy(children, children + left_count + child_offset, page.children);
+
+      right.next = page.next;
+      int right_pos = page_storage.write(FlaggedBlock<PageType>(1, right));
+      if (page.leaf) {
+        page.next = right_pos;
+      }
+      update_page(pos, page);
+
+      return right_pos;
+    }
+
+    /**
+     * Removes info recursively from the tree
+     *
+     * Pages that end up with less than the minimum number of keys are fixed
+     * by their parent, borrowing keys from a sibling or merging with it
+     */
+    void remove_recursive(const K &key, int current_pos) {
+      PageType page = read_page(current_pos);
+
+      if (page.leaf) {
+        int i = lower_index(page, key);
+        if (i == page.count || page.keys[i] != key) {
+          throw std::invalid_argument("Info not on tree");
+        }
+
+        data_storage.remove(page.children[i]);
+        std::copy(page.keys + i + 1, page.keys + page.count, page.keys + i);
+        std::copy(page.children + i + 1, page.children + page.count, page.children + i);
+        page.count--;
+        update_page(current_pos, page);
+        return;
+      }
+
+      int i = child_index(page, key);
+      remove_recursive(key, page.children[i]);
+
+      PageType child = read_page(page.children[i]);
+      if (child.count < min_keys()) {
+        fix_underflow(page, current_pos, i, child);
+      }
+    }
+
+    /**
+     * Fixes the child at index i of page, which has less than the minimum
+     * number of keys
+     */
+    void fix_underflow(PageType &page, int pos, int i, PageType &child) {
+      int child_pos = page.children[i];
+
+      // Borrow from left sibling
+      if (i > 0) {
+        int left_pos = page.children[i - 1];
+        PageType left = read_page(left_pos);
+        if (left.count > min_keys()) {
+          std::copy_backward(child.keys, child.keys + child.count, child.keys + child.count + 1);
+          int children_count = child.count + (child.leaf ? 0 : 1);
+          std::copy_backward(child.children, child.children + children_count, child.children + children_count + 1);
+
+          if (child.leaf) {
+            child.keys[0] = left.keys[left.count - 1];
+            child.children[0] = left.children[left.count - 1];
+            page.keys[i - 1] = child.keys[0];
+          } else {
+            child.keys[0] = page.keys[i - 1];
+            child.children[0] = left.children[left.count];
+            page.keys[i - 1] = left.keys[left.count - 1];
+          }
+          left.count--;
+          child.count++;
+
+          update_page(left_pos, left);
+          update_page(child_pos, child);
+          update_page(pos, page);
+          return;
+        }
+      }
+
+      // Borrow from right sibling
+      if (i < page.count) {
+        int right_pos = page.children[i + 1];
+        PageType right = read_page(right_pos);
+        if (right.count > min_keys()) {
+          int right_children_count = right.count + (right.leaf ? 0 : 1);
+
+          if (child.leaf) {
+            child.keys[child.count] = right.keys[0];
+            child.children[child.count] = right.children[0];
+            page.keys[i] = right.keys[1];
+          } else {
+            child.keys[child.count] = page.keys[i];
+            child.children[child.count + 1] = right.children[0];
+            page.keys[i] = right.keys[0];
+          }
+          child.count++;
+
+          std::copy(right.keys + 1, right.keys + right.count, right.keys);
+          std::copy(right.children + 1, right.children + right_children_count, right.children);
+          right.count--;
+
+          update_page(right_pos, right);
+          update_page(child_pos, child);
+          update_page(pos, page);
+          return;
+        }
+      }
+
+      // Merge with a sibling (always merging the right page into the left one)
+      int left_index = i > 0 ? i - 1 : i;
+      int left_pos = page.children[left_index];
+      int right_pos = page.children[left_index + 1];
+      PageType left = left_index == i ? child : read_page(left_pos);
+      PageType right = left_index == i ? read_page(right_pos) : child;
+
+      if (left.leaf) {
+        std::copy(right.keys, right.keys + right.count, left.keys + left.count);
+        std::copy(right.children, right.children + right.count, left.children + left.count);
+        left.count += right.count;
+        left.next = right.next;
+      } else {
+        left.keys[left.count] = page.keys[left_index];
+        std::copy(right.keys, right.keys + right.count, left.keys + left.count + 1);
+        std::copy(right.children, right.children + right.count + 1, left.children + left.count + 1);
+        left.count += right.count + 1;
+      }
+
+      std::copy(page.keys + left_index + 1, page.keys + page.count, page.keys + left_index);
+      std::copy(page.children + left_index + 2, page.children + page.count + 1, page.children + left_index + 1);
+      page.count--;
+
+      update_page(left_pos, left);
+      page_storage.remove(right_pos);
+      update_page(pos, page);
+    }
+
+    /**
+     * Goes down the tree and returns the leaf page where key should be
+     */
+    PageType find_leaf(const K &key) {
+      PageType page = read_page(read_root_pos());
+      while (!page.leaf) {
+        page = read_page(page.children[child_index(page, key)]);
+      }
+      return page;
+    }
+
+    /**
+     * Binary search for the index of the child of an internal page that
+     * may contain key
+     */
+    int child_index(const PageType &page, const K &key) {
+      return std::upper_bound(page.keys, page.keys + page.count, key) - page.keys;
+    }
+
+    /**
+     * Binary search for the index of the first key of the page that is
+     * bigger or equal to key
+     */
+    int lower_index(const PageType &page, const K &key) {
+      return std::lower_bound(page.keys, page.keys + page.count, key) - page.keys;
+    }
+
+    /**
+     * Minimum number of keys of every page except the root
+     */
+    static int min_keys() {
+      return Order / 2;
+    }
+
+    /**
+     * Creates a page without keys
+     */
+    PageType empty_page(int leaf) {
+      PageType page = PageType();
+      page.leaf = leaf;
+      page.count = 0;
+      page.next = -1;
+      return page;
+    }
+
+    /**
+     * Reads page stored on position passed as parameter
+     */
+    PageType read_page(int pos) {
+      return page_storage.read(pos).data;
+    }
+
+    /**
+     * Updates page on page_storage (with valid flag equal to 1) on position
+     * passed as parameter
+     */
+    void update_page(int pos, const PageType &page) {
+      page_storage.write(FlaggedBlock<PageType>(1, page), pos);
+    }
+
+    /**
+     * Writes root position at the start of tree_file
+     */
+    void write_root_pos(int pos) {
+      page_storage.write_flag(0, pos);
+    }
+
+    /**
+     * Reads root position from the start of tree_file and returns it
+     */
+    int read_root_pos() {
+      return page_storage.read_flag(0);
+    }
+
+    /**
+     * Prints tree recursively, one page per line
+     */
+    void print_recursive(std::ostream& os, int pos, int space) {
+      FlaggedBlock<PageType> block = page_storage.read(pos);
+      PageType page = block.data;
+
+      if (!block.is_valid()) {
+        os << "INVALID PAGE (this shouldn't happen)" << std::endl;
+        return;
+      }
+
+      for (int i = 0; i < space; i++) {
+        os << " ";
+      }
+
+      os << "[";
+      for (int i = 0; i < page.count; i++) {
+        os << (i ? " " : "") << page.keys[i];
+      }
+      os << "]" << std::endl;
+
+      if (!page.leaf) {
+        for (int i = 0; i <= page.count; i++) {
+          print_recursive(os, page.children[i], space + 5);
+        }
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,572 @@
+#ifndef MEMORYAVLDATABASE_H
+#define MEMORYAVLDATABASE_H
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ios>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "avl_database.hpp"
+#include "binary_storage.hpp"
+
+/**
+ * Implementation of a database using AvlTree concepts that keeps the whole
+ * tree in memory
+ *
+ * Nodes and infos live in two arrays (arenas) with the same layout as the
+ * blocks of the binary files used by AvlDatabase, addressed by index, so
+ * there is no per-node heap allocation and no file I/O on lookups. Removed
+ * blocks are kept on free lists and reused by later insertions.
+ *
+ * Both files are loaded with one sequential read on construction and written
+ * back as snapshots on demand (snapshot()), periodically by a background
+ * thread and on destruction. The files stay readable by AvlDatabase, but a
+ * snapshot interrupted by a crash is only finished when the files are opened
+ * by MemoryAvlDatabase again.
+ *
+ * @tparam K The type of the key used to compare infos
+ * @tparam T The type of the info stored
+ */
+template <typename K, typename T>
+class MemoryAvlDatabase {
+  public:
+    /**
+     * MemoryAvlDatabase constructor
+     * @param data_path path to the data binary file
+     * @param tree_path path to the tree binary file
+     * @param snapshot_interval milliseconds between background snapshots
+     *                          (0 disables them)
+     * @throws runtime_error If an interrupted snapshot can't be finished
+     */
+    MemoryAvlDatabase(std::string data_path, std::string tree_path, int snapshot_interval = 0)
+      : data_path(data_path), tree_path(tree_path), root_pos(-1), stopping(false) {
+      load();
+
+      if (snapshot_interval > 0) {
+        snapshot_thread = std::thread(&MemoryAvlDatabase::snapshot_loop, this, snapshot_interval);
+      }
+    }
+
+    /**
+     * MemoryAvlDatabase destructor
+     * Stops the background snapshots and writes a last snapshot
+     */
+    ~MemoryAvlDatabase() {
+      if (snapshot_thread.joinable()) {
+        {
+          std::lock_guard<std::mutex> lock(tree_mutex);
+          stopping = true;
+        }
+        stop_condition.notify_all();
+        snapshot_thread.join();
+      }
+
+      try {
+        snapshot();
+      } catch (std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+
+    /**
+     * Add new information to the tree
+     * @param key Key of the information (must be unique)
+     * @param info The information that will be inserted
+     * @throws invalid_argument If another information has the same key
+     */
+    void add(const K &key, const T &info) {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      root_pos = add_recursive(key, info, root_pos);
+    }
+
+    /**
+     * Removes info from tree
+     * @param key Key of the information
+     * @throws invalid_argument If information with that key doesn't exist
+     */
+    void remove(const K &key) {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      if (root_pos == -1) {
+        throw std::invalid_argument("No info matches key passed to remove()");
+      }
+
+      root_pos = remove_recursive(key, root_pos);
+    }
+
+    /**
+     * Replaces info on tree
+     * @param key Key of the information
+     * @param info The new information
+     * @throws invalid_argument If information with that key doesn't exist
+     */
+    void update(const K &key, const T &info) {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      infos[find_node(key, "update()").data_index].data = info;
+    }
+
+    /**
+     * Gets info from tree
+     * @param key Key of the information
+     * @throws invalid_argument If information with that key doesn't exist
+     */
+    T get(const K &key) {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      return infos[find_node(key, "get_info()").data_index].data;
+    }
+
+    /**
+     * Gets the tree height
+     */
+    int get_height() {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      return get_node_height(root_pos);
+    }
+
+    /**
+     * Checks if the tree is empty
+     * @return true If the tree is empty
+     * @return false If the tree is not empty
+     */
+    bool tree_is_empty() {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      return root_pos == -1;
+    }
+
+    /**
+     * Prints the tree
+     * @param os The output stream to print the tree
+     */
+    void print(std::ostream &os) {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      os << "-----------------------------" << std::endl;
+      os << "Tree height: " << get_node_height(root_pos) << std::endl;
+      print_recursive(os, root_pos, 0);
+      os << "-----------------------------" << std::endl;
+    }
+
+    /**
+     * Writes the current tree to the binary files
+     *
+     * The arenas are copied while holding the lock and written afterwards.
+     * Both files are written and synced to temporary files, then a commit
+     * file is created and only then the temporary files are renamed over
+     * the old ones. If a crash happens before the commit file exists, the
+     * old files are kept, otherwise the next load finishes the renames, so
+     * the tree and data files always come from the same snapshot.
+     *
+     * @throws runtime_error If the files can't be written
+     */
+    void snapshot() {
+      std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex);
+
+      std::vector<char> tree_buffer;
+      std::vector<char> data_buffer;
+      {
+        std::lock_guard<std::mutex> lock(tree_mutex);
+        serialize_blocks(nodes, &root_pos, 1, tree_buffer);
+        serialize_blocks(infos, NULL, 0, data_buffer);
+      }
+
+      write_file_synced(data_path + ".tmp", data_buffer);
+      write_file_synced(tree_path + ".tmp", tree_buffer);
+      sync_directory(data_path);
+      sync_directory(tree_path);
+
+      // Commit point
+      std::string commit = "snapshot";
+      write_file_atomically(get_commit_path(), std::vector<char>(commit.begin(), commit.end()));
+
+      finish_snapshot();
+    }
+
+  private:
+    std::string data_path;
+    std::string tree_path;
+
+    std::vector<FlaggedBlock<Node<K> > > nodes;
+    std::vector<FlaggedBlock<T> > infos;
+    std::vector<int> free_nodes;
+    std::vector<int> free_infos;
+
+    // Heights aren't stored on the files, they are rebuilt on load
+    std::vector<int> heights;
+    int root_pos;
+
+    std::mutex tree_mutex;
+    std::mutex snapshot_mutex;
+    std::condition_variable stop_condition;
+    std::thread snapshot_thread;
+    bool stopping;
+
+    /**
+     * Adds data recursively on the tree
+     *
+     * Returns the position of the subtree root after balancing it
+     */
+    int add_recursive(const K &key, const T &info, int current_pos) {
+      if (current_pos == -1) {
+        return new_node(key, info);
+      }
+
+      Node<K> &node = nodes[current_pos].data;
+      if (key == node.key) {
+        throw std::invalid_argument("Info already on tree");
+      } else if (key > node.key) {
+        int right = add_recursive(key, info, node.right);
+        nodes[current_pos].data.right = right;
+      } else {
+        int left = add_recursive(key, info, node.left);
+        nodes[current_pos].data.left = left;
+      }
+
+      return balance_node(current_pos);
+    }
+
+    /**
+     * Removes info recursively from the tree
+     *
+     * Returns the position of the subtree root after balancing it (-1 if the
+     * subtree became empty)
+     *
+     * A node with two childs takes the key and data of the smallest node from
+     * the right
+     */
+    int remove_recursive(const K &key, int current_pos) {
+      if (current_pos == -1) {
+        throw std::invalid_argument("Info not on tree");
+      }
+
+      Node<K> &node = nodes[current_pos].data;
+      if (key > node.key) {
+        node.right = remove_recursive(key, node.right);
+      } else if (key < node.key) {
+        node.left = remove_recursive(key, node.left);
+      } else {
+        free_info(node.data_index);
+
+        if (node.left == -1 || node.right == -1) {
+          int child = node.left == -1 ? node.right : node.left;
+          free_node(current_pos);
+          return child;
+        }
+
+        int smallest_pos;
+        int right = remove_smallest(node.right, smallest_pos);
+        Node<K> &current = nodes[current_pos].data;
+        current.right = right;
+        current.key = nodes[smallest_pos].data.key;
+        current.data_index = nodes[smallest_pos].data.data_index;
+        free_node(smallest_pos);
+      }
+
+      return balance_node(current_pos);
+    }
+
+    /**
+     * Detaches the smallest node of the subtree (without freeing it)
+     *
+     * Returns the position of the subtree root after balancing it
+     */
+    int remove_smallest(int current_pos, int &smallest_pos) {
+      Node<K> &node = nodes[current_pos].data;
+      if (node.left == -1) {
+        smallest_pos = current_pos;
+        return node.right;
+      }
+
+      node.left = remove_smallest(node.left, smallest_pos);
+      return balance_node(current_pos);
+    }
+
+    /**
+     * Finds the node with key, the caller holds the lock
+     * @throws invalid_argument If no node has that key
+     */
+    const Node<K> &find_node(const K &key, const std::string &caller) {
+      int pos = root_pos;
+      while (pos != -1) {
+        const Node<K> &node = nodes[pos].data;
+        if (key == node.key) {
+          return node;
+        }
+        pos = key > node.key ? node.right : node.left;
+      }
+
+      throw std::invalid_argument("No info matches key passed to " + caller);
+    }
+
+    /**
+     * Gets height of node at specified position
+     */
+    int get_node_height(int pos) {
+      return pos == -1 ? 0 : heights[pos];
+    }
+
+    /**
+     * Updates height and balance of node at specified position
+     */
+    void update_node(int pos) {
+      Node<K> &node = nodes[pos].data;
+      int left_height = get_node_height(node.left);
+      int right_height = get_node_height(node.right);
+      heights[pos] = std::max(left_height, right_height) + 1;
+      node.balance = right_height - left_height;
+    }
+
+    /**
+     * Balances node at specified position
+     *
+     * Returns the position of the subtree root
+     */
+    int balance_node(int pos) {
+      update_node(pos);
+      Node<K> &node = nodes[pos].data;
+
+      if (node.balance > 1) {
+        if (nodes[node.right].data.balance < 0) {
+          node.right = rotate_right(node.right);
+        }
+        return rotate_left(pos);
+      } else if (node.balance < -1) {
+        if (nodes[node.left].data.balance > 0) {
+          node.left = rotate_left(node.left);
+        }
+        return rotate_right(pos);
+      }
+
+      return pos;
+    }
+
+    /**
+     * Applies left rotation to node at given position
+     *
+     * Returns the position of the new subtree root
+     */
+    int rotate_left(int pos) {
+      int new_root_pos = nodes[pos].data.right;
+      nodes[pos].data.right = nodes[new_root_pos].data.left;
+      nodes[new_root_pos].data.left = pos;
+      update_node(pos);
+      update_node(new_root_pos);
+      return new_root_pos;
+    }
+
+    /**
+     * Applies right rotation to node at given position
+     *
+     * Returns the position of the new subtree root
+     */
+    int rotate_right(int pos) {
+      int new_root_pos = nodes[pos].data.left;
+      nodes[pos].data.left = nodes[new_root_pos].data.right;
+      nodes[new_root_pos].data.right = pos;
+      update_node(pos);
+      update_node(new_root_pos);
+      return new_root_pos;
+    }
+
+    /**
+     * Stores info and a new leaf node on the arenas, reusing free blocks
+     */
+    int new_node(const K &key, const T &info) {
+      int data_index = allocate(infos, free_infos, FlaggedBlock<T>(1, info));
+      Node<K> node = { key, data_index, 0, -1, -1 };
+      int pos = allocate(nodes, free_nodes, FlaggedBlock<Node<K> >(1, node));
+
+      heights.resize(nodes.size());
+      heights[pos] = 1;
+      return pos;
+    }
+
+    template <typename U>
+    int allocate(std::vector<FlaggedBlock<U> > &blocks, std::vector<int> &free_blocks, const FlaggedBlock<U> &block) {
+      if (free_blocks.empty()) {
+        blocks.push_back(block);
+        return blocks.size() - 1;
+      }
+
+      int index = free_blocks.back();
+      free_blocks.pop_back();
+      blocks[index] = block;
+      return index;
+    }
+
+    void free_node(int pos) {
+      nodes[pos].valid = 0;
+      free_nodes.push_back(pos);
+    }
+
+    void free_info(int index) {
+      infos[index].valid = 0;
+      free_infos.push_back(index);
+    }
+
+    /**
+     * Loads both binary files (if they exist) and rebuilds the heights
+     */
+    void load() {
+      recover_snapshot();
+
+      std::vector<int> flags;
+      std::vector<int> no_flags;
+      read_blocks(tree_path, 1, nodes, flags);
+      read_blocks(data_path, 0, infos, no_flags);
+
+      root_pos = flags.empty() ? -1 : flags[0];
+
+      for (int i = nodes.size() - 1; i >= 0; i--) {
+        if (!nodes[i].is_valid()) {
+          free_nodes.push_back(i);
+        }
+      }
+      for (int i = infos.size() - 1; i >= 0; i--) {
+        if (!infos[i].is_valid()) {
+          free_infos.push_back(i);
+        }
+      }
+
+      heights.assign(nodes.size(), 0);
+      rebuild_height(root_pos);
+    }
+
+    int rebuild_height(int pos) {
+      if (pos == -1) {
+        return 0;
+      }
+
+      Node<K> &node = nodes[pos].data;
+      heights[pos] = std::max(rebuild_height(node.left), rebuild_height(node.right)) + 1;
+      return heights[pos];
+    }
+
+    /**
+     * Reads a file with the BinaryStorage layout in one sequential read
+     */
+    template <typename U>
+    static void read_blocks(const std::string &path, int number_of_flags, std::vector<FlaggedBlock<U> > &blocks, std::vector<int> &flags) {
+      blocks.clear();
+      flags.clear();
+
+      std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+      if (!file) {
+        return;
+      }
+
+      std::vector<char> buffer(file.tellg());
+      file.seekg(0, std::ios::beg);
+      file.read(buffer.data(), buffer.size());
+
+      size_t header_size = number_of_flags * sizeof(int);
+      if (buffer.size() < header_size) {
+        return;
+      }
+
+      flags.resize(number_of_flags);
+      if (number_of_flags > 0) {
+        std::memcpy(flags.data(), buffer.data(), header_size);
+      }
+
+      size_t block_size = sizeof(int) + sizeof(U);
+      size_t count = (buffer.size() - header_size) / block_size;
+      blocks.resize(count);
+      for (size_t i = 0; i < count; i++) {
+        const char *block = buffer.data() + header_size + i * block_size;
+        std::memcpy(&blocks[i].valid, block, sizeof(int));
+        std::memcpy(&blocks[i].data, block + sizeof(int), sizeof(U));
+      }
+    }
+
+    std::string get_commit_path() {
+      return tree_path + ".commit";
+    }
+
+    static bool file_exists(const std::string &path) {
+      return std::ifstream(path).good();
+    }
+
+    /**
+     * Renames the temporary files of a committed snapshot over the binary
+     * files and removes the commit file
+     */
+    void finish_snapshot() {
+      if (file_exists(data_path + ".tmp")) {
+        rename_file(data_path + ".tmp", data_path);
+      }
+      if (file_exists(tree_path + ".tmp")) {
+        rename_file(tree_path + ".tmp", tree_path);
+      }
+      sync_directory(data_path);
+      sync_directory(tree_path);
+
+      std::remove(get_commit_path().c_str());
+      sync_directory(get_commit_path());
+    }
+
+    /**
+     * Finishes a snapshot interrupted after its commit, or discards the
+     * temporary files of one interrupted before it (including a commit file
+     * that wasn't renamed yet)
+     */
+    void recover_snapshot() {
+      std::remove((get_commit_path() + ".tmp").c_str());
+      if (file_exists(get_commit_path())) {
+        finish_snapshot();
+      } else {
+        std::remove((data_path + ".tmp").c_str());
+        std::remove((tree_path + ".tmp").c_str());
+      }
+    }
+
+    /**
+     * Background thread: writes a snapshot every interval until stopped
+     */
+    void snapshot_loop(int interval) {
+      std::unique_lock<std::mutex> lock(tree_mutex);
+      while (!stopping) {
+        if (!stop_condition.wait_for(lock, std::chrono::milliseconds(interval), [this] { return stopping; })) {
+          lock.unlock();
+          try {
+            snapshot();
+          } catch (std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+          }
+          lock.lock();
+        }
+      }
+    }
+
+    /**
+     * Prints tree recursively
+     */
+    void print_recursive(std::ostream& os, int pos, int space) {
+      if (pos == -1) {
+        return;
+      }
+
+      const Node<K> &node = nodes[pos].data;
+
+      space += 5;
+      print_recursive(os, node.right, space);
+
+      os << std::endl;
+
+      for (int i = 5 ; i < space;  i++) {
+        os << " ";
+      }
+
+      os << node.key  << " : " << node.balance << std::endl;
+
+      print_recursive(os, node.left, space);
+    }
+};
+
+#endif
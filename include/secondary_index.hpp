@@ -0,0 +1,152 @@
+#ifndef SECONDARYINDEX_H
+#define SECONDARYINDEX_H
+
+#include <iostream>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+template <typename K, typename T>
+class AvlDatabase;
+
+/**
+ * Key of a secondary index node
+ *
+ * Secondary keys aren't unique, so nodes are ordered by the secondary key and
+ * then by the primary key of the info. Bound is only used by searches: -1 is
+ * smaller and 1 is bigger than every node with the same secondary key.
+ *
+ * @tparam S The type of the secondary key
+ * @tparam K The type of the primary key
+ */
+template <typename S, typename K>
+struct IndexKey {
+  S key;
+  K primary;
+  int bound;
+
+  static IndexKey lower(const S &key) {
+    IndexKey index_key = IndexKey();
+    index_key.key = key;
+    index_key.bound = -1;
+    return index_key;
+  }
+
+  static IndexKey upper(const S &key) {
+    IndexKey index_key = IndexKey();
+    index_key.key = key;
+    index_key.bound = 1;
+    return index_key;
+  }
+
+  static IndexKey entry(const S &key, const K &primary) {
+    IndexKey index_key = IndexKey();
+    index_key.key = key;
+    index_key.primary = primary;
+    index_key.bound = 0;
+    return index_key;
+  }
+
+  bool operator<(const IndexKey &other) const {
+    if (key < other.key || other.key < key) {
+      return key < other.key;
+    }
+    if (bound != other.bound) {
+      return bound < other.bound;
+    }
+    return bound == 0 && primary < other.primary;
+  }
+
+  bool operator>(const IndexKey &other) const {
+    return other < *this;
+  }
+
+  bool operator==(const IndexKey &other) const {
+    return !(*this < other) && !(other < *this);
+  }
+
+  bool operator!=(const IndexKey &other) const {
+    return !(*this == other);
+  }
+};
+
+template <typename S, typename K>
+std::ostream &operator<<(std::ostream &os, const IndexKey<S, K> &index_key) {
+  return os << index_key.key << "/" << index_key.primary;
+}
+
+/**
+ * Interface used by AvlDatabase to keep its secondary indexes up to date
+ *
+ * @tparam K The type of the primary key
+ * @tparam T The type of the info stored
+ */
+template <typename K, typename T>
+class SecondaryIndexBase {
+  public:
+    virtual ~SecondaryIndexBase() { }
+    virtual void add(const K &primary, const T &info) = 0;
+    virtual void remove(const K &primary, const T &info) = 0;
+    virtual bool is_empty() = 0;
+    virtual void clear() = 0;
+};
+
+/**
+ * Secondary index over a field of the infos of an AvlDatabase
+ *
+ * It's an AvlDatabase of its own (with its own data and tree files) whose
+ * keys are (secondary key, primary key) pairs and whose infos are primary
+ * keys. Created by AvlDatabase::add_index().
+ *
+ * @tparam K The type of the primary key
+ * @tparam T The type of the info stored
+ * @tparam S The type of the secondary key
+ */
+template <typename K, typename T, typename S>
+class SecondaryIndex : public SecondaryIndexBase<K, T> {
+  static_assert(std::is_trivially_copyable<S>::value,
+                "Secondary keys are written to the index files as raw bytes and must be trivially copyable");
+
+  public:
+    typedef std::function<S(const T&)> Extractor;
+
+    /**
+     * SecondaryIndex constructor
+     * @param data_path path to the index data binary file
+     * @param tree_path path to the index tree binary file
+     * @param extractor function that returns the secondary key of an info
+     */
+    SecondaryIndex(std::string data_path, std::string tree_path, Extractor extractor)
+      : extractor(extractor), tree(data_path, tree_path) {
+    }
+
+    void add(const K &primary, const T &info) {
+      tree.add(IndexKey<S, K>::entry(extractor(info), primary), primary);
+    }
+
+    void remove(const K &primary, const T &info) {
+      tree.remove(IndexKey<S, K>::entry(extractor(info), primary));
+    }
+
+    bool is_empty() {
+      return tree.tree_is_empty();
+    }
+
+    void clear() {
+      tree.clear();
+    }
+
+    /**
+     * Gets primary keys of infos with secondary keys between from and to
+     * (inclusive), ordered by secondary key and then by primary key
+     */
+    std::vector<K> get_primary_keys(const S &from, const S &to) {
+      return tree.get_range(IndexKey<S, K>::lower(from), IndexKey<S, K>::upper(to));
+    }
+
+  private:
+    Extractor extractor;
+    AvlDatabase<IndexKey<S, K>, K> tree;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef STATICAVLINDEX_H
+#define STATICAVLINDEX_H
+
+#include <stdexcept>
+#include <cstring>
+#include <ios>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include "binary_storage.hpp"
+
+#ifdef _WIN32
+  #define STATIC_INDEX_MMAP 0
+#else
+  #define STATIC_INDEX_MMAP 1
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+/**
+ * Header of a static index file
+ *
+ * Padded to 64 bytes, so the key array starts on a cache line
+ */
+typedef struct StaticIndexHeader {
+  int magic;
+  int count;
+  int key_size;
+  int info_size;
+  char padding[48];
+} StaticIndexHeader;
+
+/**
+ * Read only index over a file written by AvlDatabase::export_static()
+ *
+ * The file has a header followed by count + 1 keys in Eytzinger (BFS) order,
+ * 1-indexed (slot 0 is unused), and count + 1 infos in the same order.
+ * The node at index k has its childs at 2k and 2k + 1, so the search needs
+ * no pointers and the next levels of the tree can be prefetched.
+ *
+ * The file is mapped to memory (read into memory on Windows).
+ *
+ * @tparam K The type of the key used to compare infos
+ * @tparam T The type of the info stored
+ */
+template <typename K, typename T>
+class StaticAvlIndex {
+  public:
+    static const int MAGIC = 0x53545641;
+
+    /**
+     * StaticAvlIndex constructor
+     * @param path path to the static index file
+     * @throws runtime_error If the file can't be read or isn't a static index
+     * with this key and info types
+     */
+    StaticAvlIndex(std::string path) : mapped(NULL), mapped_size(0) {
+      map_file(path);
+
+      if (mapped_size < sizeof(StaticIndexHeader)) {
+        unmap_file();
+        throw std::runtime_error("Invalid static index file " + path);
+      }
+
+      StaticIndexHeader header;
+      std::memcpy(&header, mapped, sizeof(StaticIndexHeader));
+      count = header.count;
+
+      if (header.magic != MAGIC || header.key_size != (int)sizeof(K) || header.info_size != (int)sizeof(T) ||
+          count < 0 || mapped_size != file_size(count)) {
+        unmap_file();
+        throw std::runtime_error("Invalid static index file " + path);
+      }
+
+      keys = reinterpret_cast<const K*>(mapped + sizeof(StaticIndexHeader));
+      infos = mapped + sizeof(StaticIndexHeader) + (count + 1) * sizeof(K);
+    }
+
+    /**
+     * StaticAvlIndex destructor
+     * Unmaps the file
+     */
+    ~StaticAvlIndex() {
+      unmap_file();
+    }
+
+    /**
+     * Gets info from index
+     * @param key Key of the information
+     * @throws invalid_argument If information with that key doesn't exist
+     */
+    T get(const K &key) const {
+      int k = find_index(key);
+      if (k == 0 || keys[k] != key) {
+        throw std::invalid_argument("No info matches key passed to get_info()");
+      }
+
+      T info;
+      std::memcpy(&info, infos + k * sizeof(T), sizeof(T));
+      return info;
+    }
+
+    /**
+     * Checks if the index has a key
+     */
+    bool contains(const K &key) const {
+      int k = find_index(key);
+      return k != 0 && keys[k] == key;
+    }
+
+    /**
+     * Gets the number of keys on the index
+     */
+    int size() const {
+      return count;
+    }
+
+    /**
+     * Writes a static index file
+     *
+     * The file is written next to path and renamed over it, so indexes
+     * mapping the old file keep reading it
+     * @param path path to the static index file
+     * @param sorted_keys keys in ascending order
+     * @param sorted_infos infos in the same order as the keys
+     * @throws runtime_error If the file can't be written
+     */
+    static void write(std::string path, const std::vector<K> &sorted_keys, const std::vector<T> &sorted_infos) {
+      int n = sorted_keys.size();
+      std::vector<K> keys(n + 1, K());
+      std::vector<T> infos(n + 1, T());
+      int sorted_index = 0;
+      fill_eytzinger(sorted_keys, sorted_infos, keys, infos, sorted_index, 1);
+
+      StaticIndexHeader header;
+      std::memset(&header, 0, sizeof(StaticIndexHeader));
+      header.magic = MAGIC;
+      header.count = n;
+      header.key_size = sizeof(K);
+      header.info_size = sizeof(T);
+
+      std::vector<char> buffer(file_size(n));
+      char *position = buffer.data();
+      std::memcpy(position, &header, sizeof(StaticIndexHeader));
+      position += sizeof(StaticIndexHeader);
+      std::memcpy(position, keys.data(), keys.size() * sizeof(K));
+      position += keys.size() * sizeof(K);
+      std::memcpy(position, infos.data(), infos.size() * sizeof(T));
+
+      write_file_atomically(path, buffer);
+    }
+
+  private:
+    const char *mapped;
+    size_t mapped_size;
+    std::vector<char> buffer;
+
+    int count;
+    const K *keys;
+    const char *infos;
+
+    StaticAvlIndex(const StaticAvlIndex&);
+    StaticAvlIndex& operator=(const StaticAvlIndex&);
+
+    /**
+     * Branchless search for the smallest key bigger or equal to key
+     *
+     * Goes down the implicit tree always count's height times, turning the
+     * comparison into the next index instead of a branch. The 16 descendants
+     * four levels below k are contiguous (a cache line of int keys), so they
+     * are prefetched while the next levels are compared.
+     *
+     * Returns the index of that key, or 0 if every key is smaller
+     */
+    int find_index(const K &key) const {
+      unsigned k = 1;
+      while (k <= (unsigned)count) {
+#ifdef __GNUC__
+        __builtin_prefetch(keys + 16 * k);
+#endif
+        k = 2 * k + (keys[k] < key);
+      }
+
+      // Undo the right turns taken after the last left turn
+#ifdef __GNUC__
+      k >>= __builtin_ffs(~k);
+#else
+      while (k & 1) {
+        k >>= 1;
+      }
+      k >>= 1;
+#endif
+      return k;
+    }
+
+    /**
+     * Fills keys and infos in Eytzinger order with an in-order traversal of
+     * the implicit tree
+     */
+    static void fill_eytzinger(const std::vector<K> &sorted_keys, const std::vector<T> &sorted_infos,
+                               std::vector<K> &keys, std::vector<T> &infos, int &sorted_index, int k) {
+      if (k >= (int)keys.size()) {
+        return;
+      }
+
+      fill_eytzinger(sorted_keys, sorted_infos, keys, infos, sorted_index, 2 * k);
+      keys[k] = sorted_keys[sorted_index];
+      infos[k] = sorted_infos[sorted_index];
+      sorted_index++;
+      fill_eytzinger(sorted_keys, sorted_infos, keys, infos, sorted_index, 2 * k + 1);
+    }
+
+    static size_t file_size(int count) {
+      return sizeof(StaticIndexHeader) + ((size_t)count + 1) * (sizeof(K) + sizeof(T));
+    }
+
+    void map_file(const std::string &path) {
+#if STATIC_INDEX_MMAP
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd == -1) {
+        throw std::runtime_error("Could not open static index " + path);
+      }
+
+      struct stat st;
+      if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw std::runtime_error("Could not open static index " + path);
+      }
+
+      mapped_size = st.st_size;
+      if (mapped_size > 0) {
+        void *address = mmap(NULL, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+          close(fd);
+          throw std::runtime_error("Could not map static index " + path);
+        }
+        mapped = static_cast<const char*>(address);
+      }
+      close(fd);
+#else
+      std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+      if (!file) {
+        throw std::runtime_error("Could not open static index " + path);
+      }
+
+      buffer.resize(file.tellg());
+      file.seekg(0, std::ios::beg);
+      file.read(buffer.data(), buffer.size());
+      mapped = buffer.data();
+      mapped_size = buffer.size();
+#endif
+    }
+
+    void unmap_file() {
+#if STATIC_INDEX_MMAP
+      if (mapped != NULL) {
+        munmap(const_cast<char*>(mapped), mapped_size);
+      }
+#endif
+      mapped = NULL;
+    }
+};
+
+template <typename K, typename T>
+const int StaticAvlIndex<K, T>::MAGIC;
+
+#endif
@@ -0,0 +1,132 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "avl_database.hpp"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+void removeFiles() {
+  remove("test_recovery_data.bin");
+  remove("test_recovery_tree.bin");
+  remove("test_recovery_index_data.bin");
+  remove("test_recovery_index_tree.bin");
+}
+
+void fillTree(int count) {
+  removeFiles();
+  AvlDatabase<int, int> tree("test_recovery_data.bin", "test_recovery_tree.bin");
+  for (int i = 0; i < count; i++) {
+    tree.add((i * 37) % count, i);
+  }
+  for (int i = 0; i < count; i += 3) {
+    tree.remove(i);
+  }
+}
+
+TEST(AvlDatabaseRecoveryTest, VerifiesHealthyTree) {
+  fillTree(300);
+  AvlDatabase<int, int> tree("test_recovery_data.bin", "test_recovery_tree.bin");
+
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    VerifyReport report = tree.verify(threads);
+    ASSERT_TRUE(report.is_valid()) << (report.errors.empty() ? "leaks" : report.errors[0]);
+    ASSERT_EQ(200, report.nodes);
+    ASSERT_EQ(0, report.leaked_nodes);
+  }
+}
+
+TEST(AvlDatabaseRecoveryTest, DetectsAndRebuildsBrokenTree) {
+  fillTree(300);
+
+  // Break the tree: cut the left subtree of the root and change a balance
+  {
+    BinaryStorage<Node<int> > node_storage("test_recovery_tree.bin", 1);
+    int root_pos = node_storage.read_flag(0);
+    Node<int> root = node_storage.read(root_pos).data;
+    Node<int> right = node_storage.read(root.right).data;
+    right.balance += 5;
+    node_storage.write(FlaggedBlock<Node<int> >(1, right), root.right);
+    root.left = -1;
+    node_storage.write(FlaggedBlock<Node<int> >(1, root), root_pos);
+  }
+
+  AvlDatabase<int, int> tree("test_recovery_data.bin", "test_recovery_tree.bin");
+
+  VerifyReport report = tree.verify(4);
+  ASSERT_FALSE(report.is_valid());
+  ASSERT_GT(report.error_count, 1);
+  ASSERT_GT(report.leaked_nodes, 0);
+  ASSERT_EQ(report.leaked_nodes, report.leaked_data);
+  ASSERT_EQ(200, report.nodes + report.leaked_nodes);
+
+  ASSERT_EQ(200, tree.rebuild(4));
+
+  report = tree.verify(4);
+  ASSERT_TRUE(report.is_valid());
+  ASSERT_EQ(200, report.nodes);
+  ASSERT_EQ(ceil(log2(201)), tree.get_height());
+
+  for (int i = 0; i < 300; i++) {
+    int key = (i * 37) % 300;
+    if (key % 3 == 0) {
+      ASSERT_THROW(tree.get(key), invalid_argument);
+    } else {
+      ASSERT_EQ(i, tree.get(key));
+    }
+  }
+
+  // Rebuilt tree keeps working
+  tree.add(0, -1);
+  tree.remove(1);
+  ASSERT_TRUE(tree.verify(2).is_valid());
+}
+
+TEST(AvlDatabaseRecoveryTest, RebuildsWithoutNodes) {
+  removeFiles();
+  AvlDatabase<int, int> tree("test_recovery_data.bin", "test_recovery_tree.bin");
+
+  ASSERT_TRUE(tree.verify().is_valid());
+  ASSERT_EQ(0, tree.rebuild());
+  ASSERT_TRUE(tree.tree_is_empty());
+}
+
+TEST(AvlDatabaseRecoveryTest, RebuildsSecondaryIndexes) {
+  removeFiles();
+  int dropped_key;
+  {
+    AvlDatabase<int, int> tree("test_recovery_data.bin", "test_recovery_tree.bin");
+    tree.add_index<int>("test_recovery_index_data.bin", "test_recovery_index_tree.bin",
+                        [](const int &info) { return info % 10; });
+    for (int i = 0; i < 100; i++) {
+      tree.add(i, i);
+    }
+  }
+
+  // Invalidate the data block of the root, so rebuild drops its node
+  {
+    BinaryStorage<Node<int> > node_storage("test_recovery_tree.bin", 1);
+    BinaryStorage<int> data_storage("test_recovery_data.bin", 0);
+    Node<int> root = node_storage.read(node_storage.read_flag(0)).data;
+    dropped_key = root.key;
+    data_storage.remove(root.data_index);
+  }
+
+  AvlDatabase<int, int> tree("test_recovery_data.bin", "test_recovery_tree.bin");
+  auto &last_digits = tree.add_index<int>("test_recovery_index_data.bin", "test_recovery_index_tree.bin",
+                                          [](const int &info) { return info % 10; });
+  ASSERT_EQ(99, tree.rebuild(2));
+
+  vector<int> infos = tree.get_range_by(last_digits, 0, 9);
+  ASSERT_EQ(99u, infos.size());
+  ASSERT_EQ(9u, tree.get_by(last_digits, dropped_key % 10).size());
+  ASSERT_TRUE(find(infos.begin(), infos.end(), dropped_key) == infos.end());
+
+  tree.clear();
+  ASSERT_TRUE(tree.tree_is_empty());
+  ASSERT_TRUE(tree.get_range_by(last_digits, 0, 9).empty());
+  tree.add(1, 1);
+  ASSERT_EQ(vector<int>({ 1 }), tree.get_by(last_digits, 1));
+}
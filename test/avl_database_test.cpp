@@ -72,4 +72,37 @@ TEST(AvlDatabaseTest, BalancesOnDescendingInsertionAndRemoval) {
     total--;
     ASSERT_TRUE(validHeight(total, tree.get_height()));
   }
-}
\ No newline at end of file
+}
+
+TEST(AvlDatabaseTest, KeepsValuesAfterRemovingInnerNodes) {
+  for (int i = 0; i < 20; i++) {
+    tree.add(i, i * 10);
+  }
+
+  tree.remove(7);
+  tree.remove(3);
+  for (int i = 100; i < 110; i++) {
+    tree.add(i, i * 10);
+  }
+
+  for (int i = 0; i < 20; i++) {
+    if (i != 7 && i != 3) {
+      ASSERT_EQ(i * 10, tree.get(i));
+    }
+  }
+  for (int i = 100; i < 110; i++) {
+    ASSERT_EQ(i * 10, tree.get(i));
+  }
+
+  vector<int> range = tree.get_range(2, 8);
+  ASSERT_EQ(vector<int>({ 20, 40, 50, 60, 80 }), range);
+
+  for (int i = 0; i < 20; i++) {
+    if (i != 7 && i != 3) {
+      tree.remove(i);
+    }
+  }
+  for (int i = 100; i < 110; i++) {
+    tree.remove(i);
+  }
+}
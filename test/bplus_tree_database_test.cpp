@@ -0,0 +1,101 @@
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "bplus_tree_database.hpp"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+// Small order so the tests build trees with many levels
+BPlusTreeDatabase<int, int, 4> tree("test_bplus_data.bin", "test_bplus_tree.bin");
+
+bool validHeight(int n, int height) {
+  if (n == 0) {
+    return height == 0;
+  }
+
+  // Every page except the root has at least 2 keys (order / 2)
+  if (height > floor(log(n / 2.0f) / log(3.0f)) + 2) {
+    return false;
+  }
+
+  return true;
+}
+
+TEST(BPlusTreeDatabaseTest, InsertsGetsAndRemovesOnAscendingOrder) {
+  int total = 0;
+
+  vector<int> values;
+  for (int i = -100; i <= 100; i++) {
+    values.push_back(i);
+  }
+
+  for (auto value : values) {
+    tree.add(value, value * 2);
+    total++;
+    ASSERT_TRUE(validHeight(total, tree.get_height()));
+  }
+
+  for (auto value : values) {
+    ASSERT_EQ(value * 2, tree.get(value));
+  }
+
+  for (auto value : values) {
+    tree.remove(value);
+    total--;
+    ASSERT_TRUE(validHeight(total, tree.get_height()));
+    ASSERT_THROW(tree.get(value), invalid_argument);
+  }
+
+  ASSERT_TRUE(tree.tree_is_empty());
+}
+
+TEST(BPlusTreeDatabaseTest, InsertsGetsAndRemovesOnShuffledOrder) {
+  int total = 0;
+
+  vector<int> values;
+  for (int i = 0; i < 300; i++) {
+    values.push_back((i * 37) % 300);
+  }
+
+  for (auto value : values) {
+    tree.add(value, value);
+    total++;
+    ASSERT_TRUE(validHeight(total, tree.get_height()));
+  }
+
+  ASSERT_THROW(tree.add(values[0], 0), invalid_argument);
+
+  reverse(values.begin(), values.end());
+  for (size_t i = 0; i < values.size(); i++) {
+    tree.remove(values[i]);
+    total--;
+    ASSERT_TRUE(validHeight(total, tree.get_height()));
+    if (i + 1 < values.size()) {
+      ASSERT_EQ(values[i + 1], tree.get(values[i + 1]));
+    }
+  }
+
+  ASSERT_THROW(tree.remove(0), invalid_argument);
+}
+
+TEST(BPlusTreeDatabaseTest, ScansRangesThroughLinkedLeaves) {
+  for (int i = 100; i > 0; i--) {
+    tree.add(i, i);
+  }
+
+  vector<int> infos = tree.get_range(10, 60);
+  ASSERT_EQ(51u, infos.size());
+  for (size_t i = 0; i < infos.size(); i++) {
+    ASSERT_EQ((int)i + 10, infos[i]);
+  }
+
+  ASSERT_EQ(100u, tree.get_range(-5, 500).size());
+  ASSERT_TRUE(tree.get_range(101, 200).empty());
+
+  for (int i = 1; i <= 100; i++) {
+    tree.remove(i);
+  }
+}
@@ -0,0 +1,203 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+
+#include "avl_database.hpp"
+#include "memory_avl_database.hpp"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+bool validHeight(int n, int height) {
+  if (height < ceil(log2(n + 1))) {
+    return false;
+  }
+
+  if (height > floor(1.44f * log2(n + 2) - 0.328f)) {
+    return false;
+  }
+
+  return true;
+}
+
+void removeFiles() {
+  remove("test_memory_data.bin");
+  remove("test_memory_tree.bin");
+  remove("test_memory_data.bin.tmp");
+  remove("test_memory_tree.bin.tmp");
+  remove("test_memory_tree.bin.commit");
+  remove("test_memory_tree.bin.commit.tmp");
+  remove("test_memory_data.bin.old");
+  remove("test_memory_tree.bin.old");
+}
+
+void copyFile(const string &from, const string &to) {
+  ifstream source(from, ios::binary);
+  ofstream destination(to, ios::binary | ios::trunc);
+  destination << source.rdbuf();
+}
+
+/**
+ * Writes a first snapshot (keys 0 to 99), saves a copy of its files and
+ * writes a second one (odd keys removed, keys 100 to 149 added, reusing
+ * the freed data blocks)
+ */
+void writeTwoSnapshots() {
+  removeFiles();
+  {
+    MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+    for (int i = 0; i < 100; i++) {
+      tree.add(i, i);
+    }
+  }
+  copyFile("test_memory_data.bin", "test_memory_data.bin.old");
+  copyFile("test_memory_tree.bin", "test_memory_tree.bin.old");
+
+  MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+  for (int i = 1; i < 100; i += 2) {
+    tree.remove(i);
+  }
+  for (int i = 100; i < 150; i++) {
+    tree.add(i, i);
+  }
+}
+
+TEST(MemoryAvlDatabaseTest, BalancesOnInsertionAndRemoval) {
+  removeFiles();
+  MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+  int total = 0;
+
+  vector<int> values;
+  for (int i = 0; i < 500; i++) {
+    values.push_back((i * 37) % 500);
+  }
+
+  for (auto value : values) {
+    tree.add(value, value * 2);
+    total++;
+    ASSERT_TRUE(validHeight(total, tree.get_height()));
+  }
+
+  ASSERT_THROW(tree.add(values[0], 0), invalid_argument);
+
+  for (auto value : values) {
+    ASSERT_EQ(value * 2, tree.get(value));
+  }
+
+  for (auto value : values) {
+    tree.remove(value);
+    total--;
+    ASSERT_TRUE(validHeight(total, tree.get_height()));
+    ASSERT_THROW(tree.get(value), invalid_argument);
+  }
+
+  ASSERT_TRUE(tree.tree_is_empty());
+  ASSERT_THROW(tree.remove(0), invalid_argument);
+}
+
+TEST(MemoryAvlDatabaseTest, ReloadsSnapshot) {
+  removeFiles();
+  {
+    MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+    for (int i = 0; i < 100; i++) {
+      tree.add(i, -i);
+    }
+    for (int i = 0; i < 100; i += 2) {
+      tree.remove(i);
+    }
+    tree.snapshot();
+  }
+
+  MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+  for (int i = 1; i < 100; i += 2) {
+    ASSERT_EQ(-i, tree.get(i));
+  }
+  ASSERT_THROW(tree.get(0), invalid_argument);
+  ASSERT_TRUE(validHeight(50, tree.get_height()));
+
+  // Freed blocks are reused
+  tree.add(1000, 1000);
+  ASSERT_EQ(1000, tree.get(1000));
+}
+
+TEST(MemoryAvlDatabaseTest, UpdatesInfos) {
+  removeFiles();
+  {
+    MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+    for (int i = 0; i < 20; i++) {
+      tree.add(i, i);
+    }
+    tree.update(7, -7);
+    ASSERT_EQ(-7, tree.get(7));
+    ASSERT_THROW(tree.update(20, 0), invalid_argument);
+  }
+
+  MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+  ASSERT_EQ(-7, tree.get(7));
+  ASSERT_EQ(8, tree.get(8));
+}
+
+TEST(MemoryAvlDatabaseTest, SharesFilesWithAvlDatabase) {
+  removeFiles();
+  {
+    AvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+    for (int i = 0; i < 50; i++) {
+      tree.add(i, i + 1);
+    }
+  }
+
+  {
+    MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+    for (int i = 0; i < 50; i++) {
+      ASSERT_EQ(i + 1, tree.get(i));
+    }
+    tree.add(50, 51);
+  }
+
+  AvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+  for (int i = 0; i <= 50; i++) {
+    ASSERT_EQ(i + 1, tree.get(i));
+  }
+}
+
+TEST(MemoryAvlDatabaseTest, FinishesSnapshotCommittedBeforeCrash) {
+  writeTwoSnapshots();
+
+  // Crash after the commit and the data file rename, before the tree rename
+  copyFile("test_memory_tree.bin", "test_memory_tree.bin.tmp");
+  copyFile("test_memory_tree.bin.old", "test_memory_tree.bin");
+  ofstream("test_memory_tree.bin.commit") << "snapshot";
+
+  MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+  for (int i = 0; i < 150; i++) {
+    if (i < 100 && i % 2 == 1) {
+      ASSERT_THROW(tree.get(i), invalid_argument);
+    } else {
+      ASSERT_EQ(i, tree.get(i));
+    }
+  }
+  ASSERT_FALSE(ifstream("test_memory_tree.bin.commit").good());
+  ASSERT_FALSE(ifstream("test_memory_tree.bin.tmp").good());
+}
+
+TEST(MemoryAvlDatabaseTest, DiscardsSnapshotNotCommittedBeforeCrash) {
+  writeTwoSnapshots();
+
+  // Crash while writing the commit file, before renaming it
+  copyFile("test_memory_data.bin", "test_memory_data.bin.tmp");
+  copyFile("test_memory_tree.bin", "test_memory_tree.bin.tmp");
+  copyFile("test_memory_data.bin.old", "test_memory_data.bin");
+  copyFile("test_memory_tree.bin.old", "test_memory_tree.bin");
+  ofstream("test_memory_tree.bin.commit.tmp") << "snap";
+
+  MemoryAvlDatabase<int, int> tree("test_memory_data.bin", "test_memory_tree.bin");
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(i, tree.get(i));
+  }
+  ASSERT_THROW(tree.get(100), invalid_argument);
+  ASSERT_FALSE(ifstream("test_memory_data.bin.tmp").good());
+  ASSERT_FALSE(ifstream("test_memory_tree.bin.commit.tmp").good());
+}
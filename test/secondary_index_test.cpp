@@ -0,0 +1,201 @@
+#include <cstdio>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include "avl_database.hpp"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+typedef struct Person {
+  int id;
+  int age;
+  int city;
+} Person;
+
+int age(const Person &person) {
+  return person.age;
+}
+
+void removeFiles() {
+  const char *paths[] = {
+    "test_people_data.bin", "test_people_tree.bin",
+    "test_age_data.bin", "test_age_tree.bin",
+    "test_city_data.bin", "test_city_tree.bin"
+  };
+  for (auto path : paths) {
+    remove(path);
+  }
+}
+
+vector<int> ids(const vector<Person> &people) {
+  vector<int> result;
+  for (auto &person : people) {
+    result.push_back(person.id);
+  }
+  return result;
+}
+
+TEST(SecondaryIndexTest, GetsByNonUniqueKeys) {
+  removeFiles();
+  AvlDatabase<int, Person> people("test_people_data.bin", "test_people_tree.bin");
+  auto &ages = people.add_index<int>("test_age_data.bin", "test_age_tree.bin", age);
+
+  for (int id = 0; id < 100; id++) {
+    people.add(id, Person { id, 20 + id % 10, id % 3 });
+  }
+
+  vector<int> expected;
+  for (int id = 5; id < 100; id += 10) {
+    expected.push_back(id);
+  }
+  ASSERT_EQ(expected, ids(people.get_by(ages, 25)));
+  ASSERT_TRUE(people.get_by(ages, 40).empty());
+
+  vector<Person> range = people.get_range_by(ages, 21, 22);
+  ASSERT_EQ(20u, range.size());
+  ASSERT_EQ(21, range.front().age);
+  ASSERT_EQ(22, range.back().age);
+}
+
+TEST(SecondaryIndexTest, FollowsUpdatesAndRemovals) {
+  removeFiles();
+  AvlDatabase<int, Person> people("test_people_data.bin", "test_people_tree.bin");
+  auto &ages = people.add_index<int>("test_age_data.bin", "test_age_tree.bin", age);
+  auto &cities = people.add_index<int>("test_city_data.bin", "test_city_tree.bin",
+                                       [](const Person &person) { return person.city; });
+
+  for (int id = 0; id < 50; id++) {
+    people.add(id, Person { id, 30, id % 5 });
+  }
+
+  people.update(7, Person { 7, 31, 9 });
+  ASSERT_EQ(vector<int>({ 7 }), ids(people.get_by(ages, 31)));
+  ASSERT_EQ(vector<int>({ 7 }), ids(people.get_by(cities, 9)));
+  ASSERT_EQ(49u, people.get_by(ages, 30).size());
+  ASSERT_EQ(9u, people.get_by(cities, 2).size());
+
+  for (int id = 0; id < 50; id += 2) {
+    people.remove(id);
+  }
+  ASSERT_EQ(24u, people.get_by(ages, 30).size());
+  ASSERT_EQ(vector<int>({ 1, 11, 21, 31, 41 }), ids(people.get_by(cities, 1)));
+  ASSERT_EQ(vector<int>({ 5, 15, 25, 35, 45 }), ids(people.get_by(cities, 0)));
+
+  ASSERT_THROW(people.update(0, Person { 0, 30, 0 }), invalid_argument);
+  ASSERT_THROW(people.remove(0), invalid_argument);
+  ASSERT_EQ(24u, people.get_by(ages, 30).size());
+}
+
+TEST(SecondaryIndexTest, KeepsIndexesWhenUpdateFails) {
+  removeFiles();
+  AvlDatabase<int, Person> people("test_people_data.bin", "test_people_tree.bin");
+  auto &cities = people.add_index<int>("test_city_data.bin", "test_city_tree.bin",
+                                       [](const Person &person) { return person.city; });
+  auto &ages = people.add_index<int>("test_age_data.bin", "test_age_tree.bin", [](const Person &person) {
+    if (person.age < 0) {
+      throw invalid_argument("Invalid age");
+    }
+    return person.age;
+  });
+
+  for (int id = 0; id < 10; id++) {
+    people.add(id, Person { id, 30, 1 });
+  }
+
+  // City index is updated before the age index throws
+  ASSERT_THROW(people.update(3, Person { 3, -1, 2 }), invalid_argument);
+  ASSERT_EQ(30, people.get(3).age);
+  ASSERT_EQ(1, people.get(3).city);
+  ASSERT_EQ(10u, people.get_by(cities, 1).size());
+  ASSERT_TRUE(people.get_by(cities, 2).empty());
+  ASSERT_EQ(10u, people.get_by(ages, 30).size());
+}
+
+TEST(SecondaryIndexTest, KeepsIndexesWhenAddOrRemoveFails) {
+  removeFiles();
+  bool failing = false;
+  AvlDatabase<int, Person> people("test_people_data.bin", "test_people_tree.bin");
+  auto &cities = people.add_index<int>("test_city_data.bin", "test_city_tree.bin",
+                                       [](const Person &person) { return person.city; });
+  auto &ages = people.add_index<int>("test_age_data.bin", "test_age_tree.bin", [&failing](const Person &person) {
+    if (failing || person.age < 0) {
+      throw invalid_argument("Invalid age");
+    }
+    return person.age;
+  });
+
+  for (int id = 0; id < 10; id++) {
+    people.add(id, Person { id, 30, 1 });
+  }
+
+  // City index gets the info before the age index throws
+  ASSERT_THROW(people.add(10, Person { 10, -1, 2 }), invalid_argument);
+  ASSERT_THROW(people.get(10), invalid_argument);
+  ASSERT_TRUE(people.get_by(cities, 2).empty());
+  people.add(10, Person { 10, 30, 2 });
+  ASSERT_EQ(11u, people.get_by(ages, 30).size());
+
+  failing = true;
+  ASSERT_THROW(people.remove(3), invalid_argument);
+  failing = false;
+  ASSERT_EQ(3, people.get(3).id);
+  ASSERT_EQ(10u, people.get_by(cities, 1).size());
+  ASSERT_EQ(11u, people.get_by(ages, 30).size());
+
+  people.remove(3);
+  ASSERT_EQ(9u, people.get_by(cities, 1).size());
+  ASSERT_EQ(10u, people.get_by(ages, 30).size());
+}
+
+TEST(SecondaryIndexTest, FillsNewIndexWithExistingInfos) {
+  removeFiles();
+  {
+    AvlDatabase<int, Person> people("test_people_data.bin", "test_people_tree.bin");
+    for (int id = 0; id < 30; id++) {
+      people.add(id, Person { id, id % 2, 0 });
+    }
+
+    auto &ages = people.add_index<int>("test_age_data.bin", "test_age_tree.bin", age);
+    ASSERT_EQ(15u, people.get_by(ages, 1).size());
+    people.remove(1);
+  }
+
+  // Reopened index is not filled again
+  AvlDatabase<int, Person> people("test_people_data.bin", "test_people_tree.bin");
+  auto &ages = people.add_index<int>("test_age_data.bin", "test_age_tree.bin", age);
+  ASSERT_EQ(14u, people.get_by(ages, 1).size());
+  ASSERT_EQ(15u, people.get_by(ages, 0).size());
+}
+
+TEST(SecondaryIndexTest, IndexesFixedSizeNames) {
+  typedef array<char, 16> Name;
+  struct Pet {
+    int id;
+    Name name;
+  };
+
+  removeFiles();
+  {
+    AvlDatabase<int, Pet> pets("test_people_data.bin", "test_people_tree.bin");
+    auto &names = pets.add_index<Name>("test_city_data.bin", "test_city_tree.bin",
+                                       [](const Pet &pet) { return pet.name; });
+    const char *pet_names[] = { "rex", "tom", "rex", "bob" };
+    for (int id = 0; id < 4; id++) {
+      Pet pet = Pet();
+      pet.id = id;
+      strncpy(pet.name.data(), pet_names[id], pet.name.size() - 1);
+      pets.add(id, pet);
+    }
+    ASSERT_EQ(2u, pets.get_by(names, Name({ 'r', 'e', 'x' })).size());
+  }
+
+  AvlDatabase<int, Pet> pets("test_people_data.bin", "test_people_tree.bin");
+  auto &names = pets.add_index<Name>("test_city_data.bin", "test_city_tree.bin",
+                                     [](const Pet &pet) { return pet.name; });
+  vector<Pet> found = pets.get_by(names, Name({ 'b', 'o', 'b' }));
+  ASSERT_EQ(1u, found.size());
+  ASSERT_EQ(3, found[0].id);
+}
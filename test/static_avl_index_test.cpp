@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "avl_database.hpp"
+#include "static_avl_index.hpp"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+AvlDatabase<int, int> tree("test_static_data.bin", "test_static_tree.bin");
+
+TEST(StaticAvlIndexTest, FindsEveryExportedKey) {
+  vector<int> values;
+  for (int i = 0; i < 200; i++) {
+    values.push_back((i * 37) % 200 * 3);
+  }
+
+  for (auto value : values) {
+    tree.add(value, -value);
+  }
+  tree.export_static("test_static_index.bin");
+
+  StaticAvlIndex<int, int> index("test_static_index.bin");
+  ASSERT_EQ(200, index.size());
+
+  for (auto value : values) {
+    ASSERT_EQ(-value, index.get(value));
+    ASSERT_FALSE(index.contains(value + 1));
+    ASSERT_THROW(index.get(value + 1), invalid_argument);
+  }
+  ASSERT_THROW(index.get(-1), invalid_argument);
+  ASSERT_THROW(index.get(1000), invalid_argument);
+
+  for (auto value : values) {
+    tree.remove(value);
+  }
+}
+
+TEST(StaticAvlIndexTest, ExportsEmptyTree) {
+  tree.export_static("test_static_index.bin");
+
+  StaticAvlIndex<int, int> index("test_static_index.bin");
+  ASSERT_EQ(0, index.size());
+  ASSERT_FALSE(index.contains(0));
+}
+
+TEST(StaticAvlIndexTest, RejectsInvalidFiles) {
+  ASSERT_THROW((StaticAvlIndex<int, int>("test_static_missing.bin")), runtime_error);
+  ASSERT_THROW((StaticAvlIndex<int, double>("test_static_index.bin")), runtime_error);
+
+  // A count of -1 matches the size of a bare header
+  StaticIndexHeader header;
+  memset(&header, 0, sizeof(StaticIndexHeader));
+  header.magic = StaticAvlIndex<int, int>::MAGIC;
+  header.count = -1;
+  header.key_size = sizeof(int);
+  header.info_size = sizeof(int);
+  ofstream("test_static_negative.bin", ios::binary).write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ASSERT_THROW((StaticAvlIndex<int, int>("test_static_negative.bin")), runtime_error);
+  remove("test_static_negative.bin");
+}
+
+TEST(StaticAvlIndexTest, KeepsOpenIndexWhenRewritten) {
+  StaticAvlIndex<int, int>::write("test_static_index.bin", vector<int>({ 1, 2, 3 }), vector<int>({ 10, 20, 30 }));
+  StaticAvlIndex<int, int> index("test_static_index.bin");
+
+  StaticAvlIndex<int, int>::write("test_static_index.bin", vector<int>({ 4 }), vector<int>({ 40 }));
+  ASSERT_EQ(3, index.size());
+  ASSERT_EQ(30, index.get(3));
+
+  StaticAvlIndex<int, int> rewritten("test_static_index.bin");
+  ASSERT_EQ(1, rewritten.size());
+  ASSERT_EQ(40, rewritten.get(4));
+}